@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
@@ -117,6 +118,23 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	panic("I don't know how to handle this\n");
 }
 
+/*
+ * Called on the way back to user mode. If another thread in the
+ * process has called _exit, leave instead of going back. Threads
+ * asleep in the kernel are woken by _exit (see proc_interrupt) and
+ * come through here on their way out of the failed system call.
+ */
+static
+void
+check_exiting(void)
+{
+	struct proc *p = curproc;
+
+	if (p != NULL && p != kproc && p->p_exiting) {
+		sys_thread_exit();
+	}
+}
+
 /*
  * General trap (exception) handling function for mips.
  * This is called by the assembly-language exception handler once
@@ -194,6 +212,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * A timer interrupt is how a thread spinning in user
+		 * mode finds out it should exit. Turn interrupts back
+		 * on first, the same way as below.
+		 */
+		if (!iskern && curproc != NULL && curproc->p_exiting) {
+			spl = splhigh();
+			splx(spl);
+			check_exiting();
+		}
 		goto done2;
 	}
 
@@ -314,6 +343,10 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	if (!iskern) {
+		check_exiting();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -35,6 +35,10 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <copyinout.h>
+#include <clock.h>
+#include <syscallstats.h>
+#include "opt-syscallstats.h"
 
 
 /*
@@ -80,7 +84,17 @@ syscall(struct trapframe *tf)
 {
 	int callno;
 	int32_t retval;
+	off_t retval64;
+	bool is64;
+	int whence;
+	off_t pos;
 	int err;
+#if OPT_SYSCALLSTATS
+	time_t startsecs;
+	uint32_t startnsecs;
+
+	gettime(&startsecs, &startnsecs);
+#endif
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -98,6 +112,7 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+	is64 = false;
 
 	switch (callno) {
 	    case SYS_reboot:
@@ -108,13 +123,113 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				     &retval);
+		break;
+
+#if OPT_SYSCALLSTATS
+	    case SYS_syscallstats:
+		err = sys_syscallstats((pid_t)tf->tf_a0, (int)tf->tf_a1,
+				       (userptr_t)tf->tf_a2);
+		break;
+#endif
 #ifdef UW
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (mode_t)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
 			  (userptr_t)tf->tf_a1,
 			  (int)tf->tf_a2,
 			  (int *)(&retval));
 	  break;
+	case SYS_pread:
+	case SYS_pwrite:
+	  /* The 64-bit offset skips a3 to stay aligned, so it's on the stack. */
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(off_t));
+	  if (err) {
+	    break;
+	  }
+	  if (callno == SYS_pread) {
+	    err = sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			    (size_t)tf->tf_a2, pos, (int *)(&retval));
+	  }
+	  else {
+	    err = sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			     (size_t)tf->tf_a2, pos, (int *)(&retval));
+	  }
+	  break;
+	case SYS_readv:
+	  err = sys_readv((int)tf->tf_a0,
+			  (const_userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2,
+			  (int *)(&retval));
+	  break;
+	case SYS_writev:
+	  err = sys_writev((int)tf->tf_a0,
+			   (const_userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (int *)(&retval));
+	  break;
+	case SYS_copy_file_range:
+	  err = sys_copy_file_range((int)tf->tf_a0,
+				    (int)tf->tf_a1,
+				    (size_t)tf->tf_a2,
+				    (int *)(&retval));
+	  break;
+	case SYS_lseek:
+	  /*
+	   * The 64-bit offset is aligned into a2/a3, which pushes
+	   * whence onto the stack.
+	   */
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16),
+		       &whence, sizeof(int));
+	  if (err) {
+	    break;
+	  }
+	  err = sys_lseek((int)tf->tf_a0,
+			  ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3,
+			  whence,
+			  &retval64);
+	  is64 = true;
+	  break;
+	case SYS_pipe:
+	  err = sys_pipe((userptr_t)tf->tf_a0);
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+	case SYS_dup2:
+	  err = sys_dup2((int)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)(&retval));
+	  break;
+	case SYS_fcntl:
+	  err = sys_fcntl((int)tf->tf_a0,
+			  (int)tf->tf_a1,
+			  (int)tf->tf_a2,
+			  (int *)(&retval));
+	  break;
 	case SYS__exit:
 	  sys__exit((int)tf->tf_a0);
 	  /* sys__exit does not return, execution should not get here */
@@ -136,6 +251,20 @@ syscall(struct trapframe *tf)
      case SYS_execv:
 	    err = sys_execv((char *)tf->tf_a0, (char **)tf->tf_a1);
 	    break;
+     case SYS_spawn:
+	    err = sys_spawn((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1,
+			    (userptr_t)tf->tf_a2, (int)tf->tf_a3,
+			    (pid_t *)&retval);
+	    break;
+     case SYS___thread_create:
+	    err = sys___thread_create((userptr_t)tf->tf_a0,
+				      (userptr_t)tf->tf_a1,
+				      (userptr_t)tf->tf_a2);
+	    break;
+     case SYS_thread_exit:
+	    sys_thread_exit();
+	    panic("unexpected return from sys_thread_exit");
+	    break;
 #endif // UW
 
 	    /* Add stuff here */
@@ -158,7 +287,14 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval;
+		if (is64) {
+			/* 64-bit values go in v0/v1, high word first */
+			tf->tf_v0 = (uint32_t)(retval64 >> 32);
+			tf->tf_v1 = (uint32_t)retval64;
+		}
+		else {
+			tf->tf_v0 = retval;
+		}
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 	
@@ -169,6 +305,10 @@ syscall(struct trapframe *tf)
 	
 	tf->tf_epc += 4;
 
+#if OPT_SYSCALLSTATS
+	syscallstats_record(callno, startsecs, startnsecs, err);
+#endif
+
 	/* Make sure the syscall code didn't forget to lower spl */
 	KASSERT(curthread->t_curspl == 0);
 	/* ...or leak any spinlocks */
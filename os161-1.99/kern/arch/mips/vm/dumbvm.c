@@ -33,6 +33,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <proc.h>
+#include <cpu.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
@@ -46,6 +47,15 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+/*
+ * Additional threads get 16k each, in slots stacked downward below
+ * the main stack.
+ */
+#define DUMBVM_TSTACKPAGES   4
+#define DUMBVM_TSTACKTOP(slot) \
+	(USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE - \
+	 (slot) * DUMBVM_TSTACKPAGES * PAGE_SIZE)
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -104,12 +114,57 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+/*
+ * Find the physical address backing VADDR in AS. Sets *READ_ONLY if
+ * it's in the text segment. Returns EFAULT if VADDR isn't mapped.
+ */
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+dumbvm_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret,
+		 bool *read_only)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
 	int i;
+
+	vbase1 = as->as_vbase1;
+	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
+	vbase2 = as->as_vbase2;
+	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+	stacktop = USERSTACK;
+
+	*read_only = false;
+	if (vaddr >= vbase1 && vaddr < vtop1) {
+		*ret = (vaddr - vbase1) + as->as_pbase1;
+		*read_only = true;
+	}
+	else if (vaddr >= vbase2 && vaddr < vtop2) {
+		*ret = (vaddr - vbase2) + as->as_pbase2;
+	}
+	else if (vaddr >= stackbase && vaddr < stacktop) {
+		*ret = (vaddr - stackbase) + as->as_stackpbase;
+	}
+	else {
+		for (i=0; i<AS_NTHREADSTACKS; i++) {
+			stacktop = DUMBVM_TSTACKTOP(i);
+			stackbase = stacktop - DUMBVM_TSTACKPAGES * PAGE_SIZE;
+			if (vaddr >= stackbase && vaddr < stacktop &&
+			    as->as_tstackpbase[i] != 0) {
+				*ret = (vaddr - stackbase) +
+					as->as_tstackpbase[i];
+				return 0;
+			}
+		}
+		return EFAULT;
+	}
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	paddr_t paddr;
+	int i, result;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -161,28 +216,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
 	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	bool read_only = false;
+	bool read_only;
 	bool elfloaded = as->elfloaded;
 
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-		read_only = true;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
-	}
-	else {
-		return EFAULT;
+	result = dumbvm_translate(as, faultaddress, &paddr, &read_only);
+	if (result) {
+		return result;
 	}
 
 	/* make sure it's page-aligned */
@@ -222,6 +261,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 struct addrspace *
 as_create(void)
 {
+	int i;
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
 	if (as==NULL) {
 		return NULL;
@@ -235,13 +275,33 @@ as_create(void)
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
 	as->elfloaded = false;
+	spinlock_init(&as->as_lock);
+	for (i=0; i<AS_NTHREADSTACKS; i++) {
+		as->as_tstackpbase[i] = 0;
+		as->as_tstackused[i] = false;
+	}
 
 	return as;
 }
 
+int
+as_vtop(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	bool read_only;
+
+	if (as->as_pbase1 == 0 || as->as_pbase2 == 0 ||
+	    as->as_stackpbase == 0) {
+		/* Not loaded yet. */
+		return EFAULT;
+	}
+	return dumbvm_translate(as, vaddr, ret, &read_only);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
+	cpu_forget_as(as);
+	spinlock_cleanup(&as->as_lock);
 	kfree(as);
 }
 
@@ -262,9 +322,20 @@ as_activate(void)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	/*
+	 * If this address space is already loaded here, the TLB holds
+	 * nothing but its own mappings (kernel threads that ran in
+	 * between don't touch it), so there's nothing to do.
+	 */
+	if (curcpu->c_curas == as) {
+		splx(spl);
+		return;
+	}
+
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
+	curcpu->c_curas = as;
 
 	splx(spl);
 }
@@ -366,10 +437,60 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_threadstack(struct addrspace *as, int *slot, vaddr_t *stackptr)
+{
+	paddr_t pbase;
+	int i;
+
+	spinlock_acquire(&as->as_lock);
+	for (i=0; i<AS_NTHREADSTACKS; i++) {
+		if (!as->as_tstackused[i]) {
+			break;
+		}
+	}
+	if (i == AS_NTHREADSTACKS) {
+		spinlock_release(&as->as_lock);
+		return EAGAIN;
+	}
+	as->as_tstackused[i] = true;
+	spinlock_release(&as->as_lock);
+
+	/*
+	 * The slot is ours now. dumbvm can't give memory back, so a
+	 * stack stays allocated once made and is reused from then on.
+	 */
+	if (as->as_tstackpbase[i] == 0) {
+		pbase = getppages(DUMBVM_TSTACKPAGES);
+		if (pbase == 0) {
+			as_release_threadstack(as, i);
+			return ENOMEM;
+		}
+		as_zero_region(pbase, DUMBVM_TSTACKPAGES);
+		as->as_tstackpbase[i] = pbase;
+	}
+
+	*slot = i;
+	*stackptr = DUMBVM_TSTACKTOP(i);
+	return 0;
+}
+
+void
+as_release_threadstack(struct addrspace *as, int slot)
+{
+	KASSERT(slot >= 0 && slot < AS_NTHREADSTACKS);
+
+	spinlock_acquire(&as->as_lock);
+	KASSERT(as->as_tstackused[slot]);
+	as->as_tstackused[slot] = false;
+	spinlock_release(&as->as_lock);
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+	int i;
 
 	new = as_create();
 	if (new==NULL) {
@@ -402,6 +523,31 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
+
+	/*
+	 * Copy the thread stacks in use too, as the thread doing the
+	 * copying may be running on one of them.
+	 */
+	spinlock_acquire(&old->as_lock);
+	for (i=0; i<AS_NTHREADSTACKS; i++) {
+		new->as_tstackused[i] = old->as_tstackused[i];
+	}
+	spinlock_release(&old->as_lock);
+	for (i=0; i<AS_NTHREADSTACKS; i++) {
+		if (!new->as_tstackused[i] || old->as_tstackpbase[i] == 0) {
+			/* free, or still being set up by another thread */
+			new->as_tstackused[i] = false;
+			continue;
+		}
+		new->as_tstackpbase[i] = getppages(DUMBVM_TSTACKPAGES);
+		if (new->as_tstackpbase[i] == 0) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(new->as_tstackpbase[i]),
+			(const void *)PADDR_TO_KVADDR(old->as_tstackpbase[i]),
+			DUMBVM_TSTACKPAGES*PAGE_SIZE);
+	}
 	
 	*ret = new;
 	return 0;
@@ -73,6 +73,22 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Reset c0_count, so the next interrupt is a full c0_compare away.
+ */
+static
+void
+mips_timer_reset(void)
+{
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 $0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -125,6 +141,24 @@ mainbus_start_cpus(void)
 	lamebus_start_cpus(lamebus);
 }
 
+/*
+ * Turn hardclock off and on for an idle cpu. There is no way to
+ * disable the on-chip timer short of masking its interrupt, so just
+ * push c0_compare as far out as it goes: a few minutes at 25 MHz.
+ */
+void
+mainbus_hardclock_stop(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_hardclock_start(void)
+{
+	mips_timer_reset();
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Function to generate the memory address (in the uncached segment)
  * for the specified offset into the specified slot's region of the
@@ -36,9 +36,13 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 
 struct vnode;
 
+/* Stacks for threads other than a process's first (see below). */
+#define AS_NTHREADSTACKS 7
+
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -56,6 +60,9 @@ struct addrspace {
   size_t as_npages2;
   paddr_t as_stackpbase;
   bool elfloaded;
+  struct spinlock as_lock;	/* protects as_tstackused */
+  paddr_t as_tstackpbase[AS_NTHREADSTACKS];	/* 0 until first used */
+  bool as_tstackused[AS_NTHREADSTACKS];
 };
 
 /*
@@ -72,13 +79,16 @@ struct addrspace {
  *                you.
  *
  *    as_activate - make curproc's address space the one currently
- *                "seen" by the processor.
+ *                "seen" by the processor. Does nothing if it already
+ *                is, so it is cheap to call on every context switch.
  *
  *    as_deactivate - unload curproc's address space so it isn't
  *                currently "seen" by the processor.
  *
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
+ *                Must call cpu_forget_as() so no cpu keeps skipping
+ *                activation for a reused address.
  *
  *    as_define_region - set up a region of memory within the address
  *                space.
@@ -92,6 +102,16 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_vtop   - look up the physical address a user virtual address
+ *                is mapped to. Returns EFAULT if it isn't mapped.
+ *
+ *    as_define_threadstack - set up a stack for an additional thread,
+ *                below the main one. Hands back a slot number that
+ *                identifies it and the initial stack pointer.
+ *
+ *    as_release_threadstack - the thread using stack SLOT is gone; the
+ *                stack may be handed out again.
  */
 
 struct addrspace *as_create(void);
@@ -108,6 +128,10 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_vtop(struct addrspace *as, vaddr_t vaddr, paddr_t *ret);
+int               as_define_threadstack(struct addrspace *as, int *slot,
+                                        vaddr_t *initstackptr);
+void              as_release_threadstack(struct addrspace *as, int slot);
 
 
 /*
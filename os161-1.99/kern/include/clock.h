@@ -38,8 +38,8 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU TIMER_HZ times a second. It
+ * advances the timer tick counter and fires expired timeouts.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -56,6 +56,9 @@
 #define HZ  100
 #endif
 
+/* timer ticks per second; must match LT_GRANULARITY in lamebus/ltimer.h */
+#define TIMER_HZ  100
+
 void hardclock_bootstrap(void);
 
 void hardclock(void);
@@ -67,21 +70,61 @@ void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
+/*
+ * Timeouts.
+ *
+ * A timeout calls a function once, from the timer interrupt, a given
+ * number of timer ticks in the future. Timeouts are kept in a
+ * hierarchical timer wheel, so arming, cancelling, and the per-tick
+ * work are all constant time no matter how many are pending.
+ *
+ * The struct timeout belongs to the caller and may live on its stack;
+ * it must not be freed or reused while armed. timeout_cancel stops a
+ * pending timeout, or waits for it to finish if it is already firing,
+ * so after it returns the timeout is idle either way. It returns true
+ * if it stopped the timeout before it fired.
+ *
+ * The function runs in interrupt context with no locks held. It must
+ * not sleep, and must not call timeout_cancel on its own timeout.
+ * timeout_add may be called with wait channel locks held.
+ *
+ * timer_getticks returns the number of timer ticks since boot (this
+ * wraps after a bit over a year).
+ * timer_nstoticks converts a duration to ticks, rounding up.
+ */
+struct timeout {
+	struct timeout *to_next;	/* wheel slot list */
+	struct timeout *to_prev;
+	unsigned to_expires;		/* tick at which to fire */
+	int to_state;			/* TO_IDLE, TO_PENDING or TO_FIRING */
+	void (*to_func)(void *);	/* function to call */
+	void *to_arg;			/* its argument */
+};
+
+void timeout_init(struct timeout *to, void (*func)(void *), void *arg);
+void timeout_add(struct timeout *to, unsigned ticks);
+bool timeout_cancel(struct timeout *to);
+
+unsigned timer_getticks(void);
+unsigned timer_nstoticks(uint64_t nsecs);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
- *
- *  this will be more efficient than clocknap() for longer sleeps
  */
 void clocksleep(int seconds);
 
 /*
  * clocknap() suspends execution for the requested number of timer ticks
- *
- * the timer ticks every LT_GRANULARITY usec (see kern/dev/ltimer.h)
- *
+ * (1/TIMER_HZ of a second each).
  */
 void clocknap(int ticks);
 
+/*
+ * clocksleep_ns() suspends execution for at least NSECS nanoseconds,
+ * rounded up to a whole number of timer ticks.
+ */
+void clocksleep_ns(uint64_t nsecs);
+
 
 #endif /* _CLOCK_H_ */
@@ -35,6 +35,14 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct addrspace;
+
+/*
+ * Number of scheduling priority levels. Level 0 is the highest; each
+ * level has its own run queue. See schedule() in thread.c.
+ */
+#define SCHED_NLEVELS 4
+
 
 /*
  * Per-cpu structure
@@ -59,14 +67,26 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Dead threads kept for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_lastboost;		/* c_hardclocks at last priority boost */
+
+	/*
+	 * Address space last loaded into this cpu's MMU, or NULL if
+	 * the MMU may hold anything. Set only by this cpu, but cleared
+	 * by cpu_forget_as() from any cpu.
+	 */
+	struct addrspace *c_curas;
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queue per level */
+	unsigned c_runcount;		/* Total threads on c_runqueue[] */
+	unsigned c_steals;		/* Threads this cpu stole from others */
+	unsigned c_migrations;		/* Threads stolen from this cpu */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -114,6 +134,24 @@ void cpu_hatch(unsigned software_number);
  */
 const char *cpu_identify(void);
 
+/*
+ * Make sure no cpu believes AS is still loaded in its MMU. Called
+ * when AS is destroyed, so a new address space allocated at the same
+ * address isn't mistaken for it.
+ */
+void cpu_forget_as(struct addrspace *as);
+
+/*
+ * Return the number of cpus.
+ */
+unsigned cpu_count(void);
+
+/*
+ * Print per-cpu scheduler statistics (run queue length, steals and
+ * migrations).
+ */
+void cpu_printstats(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode plus the seek position
+ * and access mode. It is reference counted, because dup2 and fork make
+ * several descriptors share one openfile (and thus one seek position).
+ *
+ * of_lock serializes I/O through the openfile so that concurrent reads
+ * and writes each see and advance the seek position atomically. It is
+ * only taken for seekable objects; devices like the console have no
+ * position to protect and go straight to the vnode.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+
+struct lock;
+struct vnode;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	bool of_append;			/* O_APPEND */
+	bool of_seekable;
+	struct lock *of_lock;		/* protects of_offset */
+	off_t of_offset;
+	struct spinlock of_reflock;	/* protects of_refcount */
+	unsigned of_refcount;
+};
+
+/*
+ * openfile_open	Open PATH (which may be destroyed) as with open().
+ * openfile_create	Make an openfile for VN, already opened by the
+ *			caller. On success the openfile owns the open
+ *			reference; on failure the caller still does.
+ * openfile_incref	Add a reference.
+ * openfile_decref	Drop a reference, closing the file on the last one.
+ */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+int openfile_create(struct vnode *vn, int flags, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * A file descriptor table. Each slot holds one reference to its
+ * openfile, and the descriptor's own flags (FD_CLOEXEC), which unlike
+ * the openfile's are not shared by dup2 or fork. ft_lock only
+ * protects the slots, not the openfiles, so it is a spinlock and
+ * never held across I/O.
+ */
+struct filetable {
+	struct spinlock ft_lock;
+	struct openfile *ft_files[OPEN_MAX];
+	int ft_flags[OPEN_MAX];
+};
+
+/*
+ * filetable_create	Make an empty table.
+ * filetable_destroy	Close everything and free the table.
+ * filetable_copy	Make a table sharing all of SRC's openfiles (fork).
+ * filetable_openstdio	Open the console on fds 0, 1 and 2.
+ * filetable_closeexec	Close every fd marked FD_CLOEXEC (execv).
+ *
+ * filetable_get	Get a reference to the openfile on FD, or EBADF.
+ *			Release it with openfile_decref.
+ * filetable_place	Put OF (consuming a reference) in the lowest free
+ *			slot and return its fd, or EMFILE.
+ * filetable_setfd	Put OF (consuming a reference) on FD, closing
+ *			whatever was there. FD must be valid.
+ * filetable_close	Close FD, or EBADF.
+ *
+ * filetable_getflags	Get FD's flags, or EBADF.
+ * filetable_setflags	Set FD's flags, or EBADF.
+ *
+ * Placing a file on an fd clears the fd's flags.
+ */
+struct filetable *filetable_create(void);
+void filetable_destroy(struct filetable *ft);
+int filetable_copy(struct filetable *src, struct filetable **ret);
+int filetable_openstdio(struct filetable *ft);
+void filetable_closeexec(struct filetable *ft);
+
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, struct openfile *of, int *fd);
+void filetable_setfd(struct filetable *ft, int fd, struct openfile *of);
+int filetable_close(struct filetable *ft, int fd);
+
+int filetable_getflags(struct filetable *ft, int fd, int *ret);
+int filetable_setflags(struct filetable *ft, int fd, int flags);
+
+
+#endif /* _FILE_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _KERN_SYSCALLSTATS_H_
+#define _KERN_SYSCALLSTATS_H_
+
+/*
+ * System call statistics, as read with syscallstats(pid, callno, buf).
+ *
+ * PID 0 asks about the whole system; otherwise PID must be the caller
+ * or one of its children (an exited child still counts until it is
+ * waited for). CALLNO is a system call number, or -1 for all calls
+ * added together. Per process, latencies are only kept for all calls
+ * together, so asking a process about one call gives an empty
+ * ss_hist.
+ *
+ * Latencies go in log2 buckets: ss_hist[0] counts calls that took
+ * under a microsecond, and ss_hist[i] for i > 0 those that took at
+ * least 2^(i-1) but under 2^i microseconds, except that the last
+ * bucket also takes everything longer.
+ */
+
+#define SCS_NCALLS    128	/* call numbers tracked are 0..SCS_NCALLS-1 */
+#define SCS_NBUCKETS  24	/* latency histogram buckets */
+
+struct syscallstat {
+	__u32 ss_calls;			/* times the call returned */
+	__u32 ss_errors;		/* ...with an error */
+	__u32 ss_hist[SCS_NBUCKETS];	/* latencies */
+};
+
+#endif /* _KERN_SYSCALLSTATS_H_ */
@@ -127,6 +127,13 @@ void *kmalloc(size_t size);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * With the kmalloctrace option, print the callsites holding the most
+ * live heap memory (at most KHEAP_MAXCALLERS of them).
+ */
+#define KHEAP_MAXCALLERS 32
+void kheap_printcallers(unsigned num);
+
 /*
  * C string functions. 
  *
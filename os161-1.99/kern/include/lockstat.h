@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics (kernel option "lockstat").
+ *
+ * Spinlocks, locks, semaphores and CVs each carry a struct lockstat
+ * when the option is on. Locks, semaphores and CVs are registered
+ * under their names when created; spinlocks have no names and are
+ * registered, by address, the first time they are contended.
+ *
+ * Times are in timer ticks (see <clock.h>). Most waits are shorter
+ * than a tick and count as zero, but a wait of a fraction F of a tick
+ * crosses a tick boundary with probability F, so totals over many
+ * waits still come out right on average.
+ *
+ * For a CV, "acquires" are waits, all of them count as contended, and
+ * there is no hold time. For a semaphore there is no hold time either.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+struct spinlock;
+
+struct lockstat {
+	const char *ls_kind;		/* "lock", "sem", etc.; NULL if unregistered */
+	const char *ls_name;		/* name, or NULL for spinlocks */
+	const void *ls_obj;		/* the lock itself */
+	struct lockstat *ls_next;	/* registry list */
+	struct lockstat *ls_prev;
+
+	unsigned ls_acquires;		/* times acquired */
+	unsigned ls_contended;		/* times we had to wait */
+	unsigned ls_waitticks;		/* total time waiting */
+	unsigned ls_maxwait;		/* longest wait */
+	unsigned ls_holdticks;		/* total time held */
+	unsigned ls_heldsince;		/* when last acquired */
+};
+
+/* Protects the registry. Never itself profiled. */
+extern struct spinlock lockstat_lock;
+
+/*
+ * init		Zero LS; it starts out unregistered.
+ * register	Add LS to the registry, under NAME (which must stay valid
+ *		until unregister; NULL for spinlocks) and KIND.
+ * unregister	Remove LS from the registry, if it's there.
+ *
+ * acquired	Record an acquisition that started waiting at tick
+ *		START. Call while holding the lock.
+ * released	Record a release. Call while still holding the lock.
+ * spinacquired	Like acquired, for spinlocks: also registers the
+ *		spinlock OBJ the first time it's contended. (Spinlocks
+ *		made with SPINLOCK_INITIALIZER never see lockstat_init,
+ *		so this is where they get their address.)
+ *
+ * print	Print the NUM most contended registered locks.
+ * reset	Zero everyone's counters.
+ */
+void lockstat_init(struct lockstat *ls, const void *obj);
+void lockstat_register(struct lockstat *ls, const char *kind,
+		       const char *name);
+void lockstat_unregister(struct lockstat *ls);
+
+void lockstat_acquired(struct lockstat *ls, unsigned start, bool contended);
+void lockstat_released(struct lockstat *ls);
+void lockstat_spinacquired(struct lockstat *ls, const void *obj,
+			   unsigned start, bool contended);
+
+void lockstat_print(unsigned num);
+void lockstat_reset(void);
+
+/* Most locks lockstat_print will show */
+#define LOCKSTAT_MAXPRINT 32
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -38,11 +38,14 @@
 
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <syscallstats.h>
 #include "opt-A2.h"
 
 
 struct addrspace;
 struct vnode;
+struct filetable;
+struct wchan;
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -55,29 +58,45 @@ struct proc {
 	struct spinlock p_lock;		/* Lock for this structure */
 	struct threadarray p_threads;	/* Threads in this process */
 
+	/*
+	 * Set by _exit, under p_lock. The other threads notice on
+	 * their way back to user mode and leave too; the last one out
+	 * passes p_exitcode to proc_exit.
+	 */
+	volatile bool p_exiting;
+	int p_exitcode;
+
+#if OPT_SYSCALLSTATS
+	/* System call counts, protected by p_lock. */
+	struct syscallstats_proc p_sysstats;
+#endif
+
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
-
-	pid_t pid;
+	struct filetable *p_files;	/* open file descriptors */
+
+	/*
+	 * Process tree, protected by proctree_lock. Once a process
+	 * with a living parent exits, all that's left of it is a
+	 * zombie: these fields and the name, kept until the parent
+	 * collects the exit code or exits itself.
+	 */
+	pid_t pid;			/* 0 once out of the pid table */
 	struct proc *parent;
 	int exit_code;
-	struct lock *lk;
-	struct cv *terminating;
-	struct array* children;
-	bool killed;
-
-
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	struct cv *p_waitcv;		/* signalled when a child exits */
+	struct proc *p_children;	/* first child */
+	struct proc *p_sibnext;		/* parent's next child */
+	struct proc *p_sibprev;		/* parent's previous child */
+	struct proc *p_exited;		/* zombie children, oldest first */
+	struct proc *p_exitedtail;	/* newest zombie child */
+	struct proc *p_exitnext;	/* parent's next zombie */
+	struct proc *p_exitprev;	/* parent's previous zombie */
+	struct proc *p_pidnext;		/* pid table hash chain */
+	bool killed;			/* exited; this is a zombie */
 
 	/* add more material here as needed */
 };
@@ -85,6 +104,9 @@ struct proc {
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
+/* Protects the process tree fields of every process. */
+extern struct lock *proctree_lock;
+
 /* Semaphore used to signal when there are no more processes */
 #ifdef UW
 extern struct semaphore *no_proc_sem;
@@ -99,11 +121,49 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/*
+ * Finish exiting: PROC's last thread has detached itself and its
+ * address space is gone. Releases everything else; PROC is either
+ * destroyed or left as a zombie for its parent.
+ */
+void proc_exit(struct proc *proc, int exitcode);
+
+/*
+ * Process tree operations. Call with proctree_lock held.
+ *
+ * proc_lookup	Find the process with pid PID, or NULL. O(1).
+ * proc_addchild Make CHILD a child of PARENT.
+ * proc_unlink	Take PROC out of the tree and the pid table, so that
+ *		nobody else can find it, prior to proc_destroy.
+ */
+struct proc *proc_lookup(pid_t pid);
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_unlink(struct proc *proc);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
-/* Detach a thread from its process. */
-void proc_remthread(struct thread *t);
+/* Detach a thread from its process. Returns how many are left. */
+unsigned proc_remthread(struct thread *t);
+
+/*
+ * Interruptible sleeps, for user threads that may wait indefinitely
+ * (on a pipe, say), so _exit can get them moving again.
+ *
+ * proc_sleepbegin  Note that the current thread may sleep on WC.
+ *                  Call before locking WC. Returns EINTR if the
+ *                  process is exiting.
+ * proc_sleep       With WC locked, sleep on it, unless the process is
+ *                  exiting, in which case just unlock it.
+ * proc_sleepend    Done; call once awake, whatever woke us.
+ * proc_interrupt   Wake every thread of PROC between begin and end.
+ *                  WC stays valid until then, as the sleeper can't
+ *                  get past proc_sleepend while we hold p_lock.
+ */
+int proc_sleepbegin(struct wchan *wc);
+void proc_sleep(struct wchan *wc);
+void proc_sleepend(void);
+void proc_interrupt(struct proc *proc);
 
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
@@ -48,6 +48,9 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+#if OPT_LOCKSTAT
+        struct lockstat sem_stat;       /* protected by sem_lock */
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
@@ -71,17 +74,53 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A lock has one of two release policies, chosen at creation:
+ *    LOCK_BARGE   - lock_release frees the lock and wakes a waiter,
+ *                   but whoever gets to lock_acquire first wins,
+ *                   woken or not. Best throughput. lock_create
+ *                   makes locks of this kind.
+ *    LOCK_HANDOFF - lock_release gives the lock straight to the
+ *                   longest waiter, so nobody can cut in and the
+ *                   waiter doesn't have to compete for it again.
+ *                   Fair, at the cost of the lock staying unused
+ *                   until the waiter gets to run.
+ * Either way, releasing a lock nobody is waiting for doesn't touch
+ * the wait channel.
+ *
+ * Locks are adaptive: lock_acquire spins for a while instead of
+ * sleeping if the owner is running on another cpu, since it will
+ * probably let go sooner than a sleep and wakeup would take.
+ * lk_spins and lk_blocks count how often each happened.
+ *
+ * Locks also do priority inheritance: while a thread sleeps waiting
+ * for a lock, the owner is scheduled at least as well as the waiter,
+ * and so on down the chain if the owner is itself waiting for a lock.
+ * The lk_pi* fields keep track of this; they're only used once the
+ * lock is contended.
  */
+#define LOCK_BARGE	0
+#define LOCK_HANDOFF	1
+
 struct lock {
         char *lk_name;
-        struct thread *owner_thread;
+        struct thread *volatile owner_thread;
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        int lk_mode;                    /* LOCK_BARGE or LOCK_HANDOFF */
+        volatile unsigned lk_waiters;   /* threads asleep on lk_wchan */
+        unsigned lk_spins;              /* times lock_acquire spun */
+        unsigned lk_blocks;             /* times lock_acquire slept */
+        struct thread *lk_piowner;      /* owner, if it's lending to it */
+        struct thread *lk_piwaiters;    /* threads lending to the owner */
+        struct lock *lk_heldnext;       /* next in lk_piowner's t_heldlocks */
+#if OPT_LOCKSTAT
+        struct lockstat lk_stat;        /* protected by lk_lock */
+#endif
 };
 
 struct lock *lock_create(const char *name);
+struct lock *lock_create_mode(const char *name, int mode);
 void lock_acquire(struct lock *);
 
 /*
@@ -117,6 +156,9 @@ void lock_destroy(struct lock *);
 struct cv {
         char *cv_name;
         struct wchan *cv_chan;
+#if OPT_LOCKSTAT
+        struct lockstat cv_stat;        /* protected by the caller's lock */
+#endif
         // add what you need here
         // (don't forget to mark things volatile as needed)
 };
@@ -128,8 +170,12 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but give up after TICKS timer ticks
+ *                   (see <clock.h>). Returns ETIMEDOUT if it gave up.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
- *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_broadcast - Wake up all threads sleeping on this CV. (They are
+ *                   actually moved to the lock's queue and woken one
+ *                   at a time as the lock is released.)
  *
  * For all three operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
@@ -138,8 +184,58 @@ void cv_destroy(struct cv *);
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers, or one writer, may hold the lock at once.
+ * Writers have preference: once a writer is waiting, new readers
+ * wait behind it, so a steady stream of readers can't starve
+ * writers. (This also means a reader must not try to take the read
+ * lock again while holding it; a writer could be queued in between.)
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_lock;
+        struct wchan *rw_rwchan;                /* readers wait here */
+        struct wchan *rw_wwchan;                /* writers wait here */
+        struct wchan *rw_uwchan;                /* the upgrader waits here */
+        volatile unsigned rw_readers;           /* readers holding it */
+        volatile unsigned rw_waitingwriters;    /* writers waiting */
+        struct thread *volatile rw_writer;      /* writer holding it */
+        struct thread *volatile rw_upgrader;    /* reader upgrading */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Release a read lock.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Release a write lock.
+ *    rwlock_upgrade       - Turn a read lock into a write lock without
+ *                           letting any other writer in between. Only
+ *                           one reader can be upgrading at a time; if
+ *                           another already is, fails with EBUSY and
+ *                           the caller still has its read lock.
+ *    rwlock_downgrade     - Turn a write lock into a read lock without
+ *                           letting any other writer in between.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+int rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
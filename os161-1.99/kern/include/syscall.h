@@ -52,6 +52,9 @@ void enter_forked_process(struct trapframe *tf);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
+/* Set up the futex wait queues. */
+void futex_bootstrap(void);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -59,14 +62,35 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys_futex_wait(userptr_t uaddr, int expected);
+int sys_futex_wake(userptr_t uaddr, int count, int32_t *retval);
+int sys_syscallstats(pid_t pid, int callno, userptr_t buf);
 
 #ifdef UW
+int sys_open(userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos,
+	       int *retval);
+int sys_readv(int fdesc, const_userptr_t uiov, int iovcnt, int *retval);
+int sys_writev(int fdesc, const_userptr_t uiov, int iovcnt, int *retval);
+int sys_copy_file_range(int infd, int outfd, size_t len, int *retval);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_close(int fdesc);
+int sys_pipe(userptr_t ufds);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_fcntl(int fdesc, int cmd, int arg, int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_fork(struct trapframe *tf, pid_t *ret);
 int sys_execv(char *progname, char **args);
+int sys_spawn(userptr_t uprogname, userptr_t uargs, userptr_t ufds, int nfds,
+              pid_t *retval);
+int sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg);
+void sys_thread_exit(void);
 
 
 #endif // UW
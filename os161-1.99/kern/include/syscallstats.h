@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _SYSCALLSTATS_H_
+#define _SYSCALLSTATS_H_
+
+/*
+ * System call statistics (kernel option "syscallstats").
+ *
+ * syscall() notes the time on entry and, on the way out, records the
+ * call's latency and whether it failed: in a table for the whole
+ * system, and in the calling process. Calls that don't return
+ * (_exit, thread_exit, and execv when it works) aren't recorded.
+ *
+ * Times come from the real-time clock, which has nanosecond
+ * resolution on System/161 but costs a bus read on each end of every
+ * call; hence the option.
+ *
+ * See <kern/syscallstats.h> for what is kept and how to read it from
+ * userlevel.
+ */
+
+#include <kern/syscallstats.h>
+#include "opt-syscallstats.h"
+
+#if OPT_SYSCALLSTATS
+
+/* The per-process part. Protected by the process's p_lock. */
+struct syscallstats_proc {
+	uint32_t sp_calls[SCS_NCALLS];
+	uint32_t sp_errors[SCS_NCALLS];
+	uint32_t sp_hist[SCS_NBUCKETS];	/* all calls together */
+};
+
+/*
+ * proc_init	Zero a new process's counts.
+ * record	Record a return from call CALLNO, which was entered at
+ *		STARTSECS/STARTNSECS (from gettime), with error ERR.
+ * get		Fill in RET as described in <kern/syscallstats.h>.
+ *
+ * lookup	Find a call number by name; returns -1 if unknown.
+ * print	Print the system-wide counts for every call made.
+ * printcall	Print the whole latency histogram of one call.
+ * reset	Zero the system-wide counts.
+ */
+void syscallstats_proc_init(struct syscallstats_proc *sp);
+void syscallstats_record(int callno, time_t startsecs, uint32_t startnsecs,
+			 int err);
+int syscallstats_get(pid_t pid, int callno, struct syscallstat *ret);
+
+int syscallstats_lookup(const char *name);
+void syscallstats_print(void);
+void syscallstats_printcall(int callno);
+void syscallstats_reset(void);
+
+#endif /* OPT_SYSCALLSTATS */
+
+#endif /* _SYSCALLSTATS_H_ */
@@ -60,6 +60,9 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwlocktest(int, char **);
+int spinlockbench(int, char **);
+int pitest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -55,6 +56,12 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are stored in the thread; longer ones are kstrdup'd */
+#define THREAD_NAMEBUF 32
+
+/* Maximum number of dead threads (with stacks) each cpu keeps for reuse */
+#define THREAD_CACHE_MAX 8
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -73,16 +80,41 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+	char t_namebuf[THREAD_NAMEBUF];	/* Storage for short t_name */
 
 	/*
 	 * Thread subsystem internal fields.
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
+	struct wchan *t_wchan;		/* Channel we're on, if sleeping */
+	bool t_requeued;		/* Moved here by wchan_requeue */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	int t_ustack;			/* User stack slot, or -1 for the main one */
+	struct wchan *t_intrwchan;	/* Interruptible sleep; see proc.h */
+
+	/*
+	 * Scheduler fields. t_priority is the thread's MLFQ level
+	 * (0 is highest); t_ticks counts the hardclocks it has run
+	 * for since it last changed level.
+	 *
+	 * t_inherited is the best level lent to us by threads waiting
+	 * for locks we hold (SCHED_NLEVELS if none); we are scheduled
+	 * at the better of the two (see thread_effpriority). The lock
+	 * fields below it track who is lending what, and are protected
+	 * by a lock private to synch.c.
+	 */
+	int t_priority;			/* Scheduling priority level */
+	int t_inherited;		/* Level inherited through locks */
+	int t_runlevel;			/* Run queue we're on, or -1 */
+	unsigned t_ticks;		/* Quantum used at this level */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks when last run */
+	struct lock *t_blockedon;	/* Lock we're waiting for */
+	struct thread *t_piwaitnext;	/* Next waiter for t_blockedon */
+	struct lock *t_heldlocks;	/* Contended locks we hold */
 
 	/*
 	 * Interrupt state fields.
@@ -158,13 +190,49 @@ void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge a clock tick to the current thread and preempt it if its
+ * quantum has run out or a higher-priority thread is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_timeslice(void);
+
+/*
+ * Scheduler tunables: the quantum, in hardclocks, of a priority
+ * level, or for level SCHED_NLEVELS the interval between priority
+ * boosts. thread_setquantum returns EINVAL for a bad level or zero.
+ */
+unsigned thread_getquantum(int level);
+int thread_setquantum(int level, unsigned hardclocks);
+
+/*
+ * Move the current thread to scheduling level LEVEL, for tests that
+ * need threads at particular levels. From there it is demoted,
+ * promoted and boosted as usual.
+ */
+void thread_setpriority(int level);
+
+/*
+ * Priority inheritance support for synch.c.
+ *
+ * thread_effpriority returns the level T is scheduled at: the better
+ * of its own and its inherited level.
+ *
+ * thread_setinherited sets T's inherited level, moving T to the
+ * matching run queue if it's on one.
+ */
+int thread_effpriority(const struct thread *t);
+void thread_setinherited(struct thread *t, int level);
+
+/*
+ * Age the run queues so low-priority threads cannot starve. Called
+ * from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Balance ready threads between CPUs: steal work if this CPU has less
+ * than its share, or wake an idle CPU to steal from us if it has
+ * more. Called from the timer interrupt.
  */
 void thread_consider_migration(void);
 
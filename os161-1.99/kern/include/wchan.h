@@ -36,6 +36,7 @@
 
 
 struct wchan; /* Opaque */
+struct thread;
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -71,15 +72,42 @@ void wchan_unlock(struct wchan *wc);
  */
 void wchan_sleep(struct wchan *wc);
 
+/*
+ * Like wchan_sleep, but wake up anyway after TICKS timer ticks (see
+ * <clock.h>). Returns ETIMEDOUT if that happened, or 0 if woken by
+ * wchan_wake*.
+ */
+int wchan_timedsleep(struct wchan *wc, unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The queue should not already be locked.
  *
+ * wchan_wakeone returns the thread it woke, or NULL if there was
+ * none. The thread may already be running by the time the caller
+ * sees it, so the pointer is only good for identifying it (e.g. by
+ * comparing it to curthread later).
+ *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc);
+struct thread *wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up thread T if and only if it is sleeping on WC. Returns true
+ * if it was. The queue should not already be locked.
+ */
+bool wchan_wakethread(struct wchan *wc, struct thread *t);
+
+/*
+ * Move every thread sleeping on FROM over to TO, without waking any
+ * of them, and return how many there were. FROM must be locked; TO
+ * must not be. Each thread moved gets its t_requeued flag set, so
+ * that when it eventually wakes it can tell where it was woken from;
+ * clearing the flag is up to the caller's protocol.
+ */
+unsigned wchan_requeue(struct wchan *from, struct wchan *to);
+
 
 #endif /* _WCHAN_H_ */
@@ -43,13 +43,16 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
-#include <kern/fcntl.h>
+#include <wchan.h>
+#include <file.h>
 #include "opt-A2.h"
 
 /*
@@ -57,6 +60,11 @@
  */
 struct proc *kproc;
 
+/*
+ * Protects the parent/child links and exit status of all processes.
+ */
+struct lock *proctree_lock;
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -70,7 +78,20 @@ static struct semaphore *proc_count_mutex;
 struct semaphore *no_proc_sem;   
 #endif  // UW
 
-static volatile pid_t pid_counter;
+/*
+ * PID table: a hash of all processes with pids, chained through
+ * p_pidnext, protected by proctree_lock. New pids are handed out
+ * round-robin from pid_next, skipping any still in use, so a pid
+ * isn't reused until the rest of the pid space has been gone
+ * through. With far fewer processes than pids, that takes a lookup
+ * or two at most.
+ */
+#define PIDTABLE_SIZE 256
+#define PIDTABLE_HASH(pid) ((unsigned)(pid) % PIDTABLE_SIZE)
+
+static struct proc *pidtable[PIDTABLE_SIZE];
+static pid_t pid_next;
+static unsigned pid_count;
 
 /*
  * Create a proc structure.
@@ -93,25 +114,39 @@ proc_create(const char *name)
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+	proc->p_exiting = false;
+	proc->p_exitcode = 0;
+#if OPT_SYSCALLSTATS
+	syscallstats_proc_init(&proc->p_sysstats);
+#endif
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_files = NULL;
 
-	proc->children = array_create();
-	proc->lk = lock_create("lock");
-	proc->terminating = cv_create("terminating");
+	proc->p_waitcv = cv_create("waitpid");
+	if (proc->p_waitcv == NULL) {
+		spinlock_cleanup(&proc->p_lock);
+		threadarray_cleanup(&proc->p_threads);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 	proc->parent = NULL;
 	proc->pid = 0;
+	proc->p_children = NULL;
+	proc->p_sibnext = NULL;
+	proc->p_sibprev = NULL;
+	proc->p_exited = NULL;
+	proc->p_exitedtail = NULL;
+	proc->p_exitnext = NULL;
+	proc->p_exitprev = NULL;
+	proc->p_pidnext = NULL;
 	proc->killed = false;
 
-
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
-
 	return proc;
 }
 
@@ -144,23 +179,32 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	if (proc->p_files) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+	}
 
-	lock_acquire(proc->lk);
-	for (int i = array_num(proc->children)-1; i>=0; --i) {
-	    struct proc *child = array_get(proc->children, i);
-	    child->parent = NULL;
-	    array_remove(proc->children, i);
-	    if (child->killed) {
-	        as_destroy(child->p_addrspace);
-	        proc_destroy(child);
-	    }
+	if (proc->pid != 0) {
+		lock_acquire(proctree_lock);
+		proc_unlink(proc);
+		lock_release(proctree_lock);
+	}
+	KASSERT(proc->p_children == NULL);
+	if (proc->p_waitcv != NULL) {
+		cv_destroy(proc->p_waitcv);
+	}
+
+#ifdef UW
+	/*
+	 * Exiting processes destroy their own address space in sys_exit;
+	 * this is for a forked child that never got to run.
+	 */
+	if (proc->p_addrspace) {
+		as_destroy(proc->p_addrspace);
+		proc->p_addrspace = NULL;
 	}
-	array_destroy(proc->children);
-	lock_release(proc->lk);
-	lock_destroy(proc->lk);
-	cv_destroy(proc->terminating);
+#else
 
-#ifndef UW  // in the UW version, space destruction occurs in sys_exit, not here
 	if (proc->p_addrspace) {
 		/*
 		 * In case p is the currently running process (which
@@ -181,12 +225,6 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
-	}
-#endif // UW
-
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
@@ -211,17 +249,212 @@ proc_destroy(struct proc *proc)
 
 }
 
+/*
+ * Take PROC off its parent's list of children and forget the parent.
+ * Call with proctree_lock held.
+ */
+static
+void
+proc_detach(struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proctree_lock));
+	KASSERT(proc->parent != NULL);
+
+	if (proc->p_sibprev != NULL) {
+		proc->p_sibprev->p_sibnext = proc->p_sibnext;
+	}
+	else {
+		proc->parent->p_children = proc->p_sibnext;
+	}
+	if (proc->p_sibnext != NULL) {
+		proc->p_sibnext->p_sibprev = proc->p_sibprev;
+	}
+	proc->parent = NULL;
+	proc->p_sibnext = proc->p_sibprev = NULL;
+}
+
+/*
+ * Release what an exiting process no longer needs, so a zombie
+ * takes up little more than its struct proc until it's collected.
+ */
+void
+proc_exit(struct proc *proc, int exitcode)
+{
+	struct proc *child;
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	KASSERT(proc->p_addrspace == NULL);
+
+	/* Nobody else looks at these, so no need for p_lock. */
+	if (proc->p_cwd) {
+		VOP_DECREF(proc->p_cwd);
+		proc->p_cwd = NULL;
+	}
+	if (proc->p_files) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+	}
+
+	lock_acquire(proctree_lock);
+
+	/* Orphan our children; nobody will collect the dead ones. */
+	while ((child = proc->p_children) != NULL) {
+		if (child->killed) {
+			proc_unlink(child);
+			proc_destroy(child);
+		}
+		else {
+			proc_detach(child);
+		}
+	}
+
+	KASSERT(proc->p_exited == NULL);
+
+	/* With no threads left, nobody can be waiting in waitpid. */
+	cv_destroy(proc->p_waitcv);
+	proc->p_waitcv = NULL;
+
+	if (proc->parent != NULL) {
+		/*
+		 * Leave the zombie on the parent's queue of exited
+		 * children. It may destroy it as soon as we let go of
+		 * proctree_lock.
+		 */
+		proc->exit_code = exitcode;
+		proc->killed = true;
+		proc->p_exitnext = NULL;
+		proc->p_exitprev = proc->parent->p_exitedtail;
+		if (proc->p_exitprev != NULL) {
+			proc->p_exitprev->p_exitnext = proc;
+		}
+		else {
+			proc->parent->p_exited = proc;
+		}
+		proc->parent->p_exitedtail = proc;
+		cv_broadcast(proc->parent->p_waitcv, proctree_lock);
+		lock_release(proctree_lock);
+	}
+	else {
+		proc_unlink(proc);
+		lock_release(proctree_lock);
+		proc_destroy(proc);
+	}
+}
+
+struct proc *
+proc_lookup(pid_t pid)
+{
+	struct proc *p;
+
+	KASSERT(lock_do_i_hold(proctree_lock));
+
+	for (p = pidtable[PIDTABLE_HASH(pid)]; p != NULL; p = p->p_pidnext) {
+		if (p->pid == pid) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* Give PROC a pid. Returns ENPROC if they're all taken. */
+static
+int
+pid_alloc(struct proc *proc)
+{
+	pid_t pid;
+	unsigned bucket;
+
+	KASSERT(lock_do_i_hold(proctree_lock));
+	KASSERT(proc->pid == 0);
+
+	if (pid_count == PID_MAX - PID_MIN + 1) {
+		return ENPROC;
+	}
+	do {
+		pid = pid_next;
+		pid_next = (pid == PID_MAX) ? PID_MIN : pid + 1;
+	} while (proc_lookup(pid) != NULL);
+
+	proc->pid = pid;
+	bucket = PIDTABLE_HASH(pid);
+	proc->p_pidnext = pidtable[bucket];
+	pidtable[bucket] = proc;
+	pid_count++;
+	return 0;
+}
+
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(lock_do_i_hold(proctree_lock));
+	KASSERT(child->parent == NULL);
+
+	child->parent = parent;
+	child->p_sibprev = NULL;
+	child->p_sibnext = parent->p_children;
+	if (parent->p_children != NULL) {
+		parent->p_children->p_sibprev = child;
+	}
+	parent->p_children = child;
+}
+
+void
+proc_unlink(struct proc *proc)
+{
+	struct proc **pp;
+
+	KASSERT(lock_do_i_hold(proctree_lock));
+
+	if (proc->parent != NULL && proc->killed) {
+		if (proc->p_exitprev != NULL) {
+			proc->p_exitprev->p_exitnext = proc->p_exitnext;
+		}
+		else {
+			proc->parent->p_exited = proc->p_exitnext;
+		}
+		if (proc->p_exitnext != NULL) {
+			proc->p_exitnext->p_exitprev = proc->p_exitprev;
+		}
+		else {
+			proc->parent->p_exitedtail = proc->p_exitprev;
+		}
+		proc->p_exitnext = proc->p_exitprev = NULL;
+	}
+
+	if (proc->parent != NULL) {
+		proc_detach(proc);
+	}
+
+	if (proc->pid != 0) {
+		for (pp = &pidtable[PIDTABLE_HASH(proc->pid)]; *pp != proc;
+		     pp = &(*pp)->p_pidnext) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = proc->p_pidnext;
+		proc->p_pidnext = NULL;
+		proc->pid = 0;
+		pid_count--;
+	}
+}
+
 /*
  * Create the process structure for the kernel.
  */
 void
 proc_bootstrap(void)
 {
-    pid_counter = 1;
+  pid_next = PID_MIN;
+  pid_count = 0;
   kproc = proc_create("[kernel]");
   if (kproc == NULL) {
     panic("proc_create for kproc failed\n");
   }
+  proctree_lock = lock_create("proctree");
+  if (proctree_lock == NULL) {
+    panic("could not create proctree_lock\n");
+  }
 #ifdef UW
   proc_count = 0;
   proc_count_mutex = sem_create("proc_count_mutex",1);
@@ -239,34 +472,21 @@ proc_bootstrap(void)
  * Create a fresh proc for use by runprogram.
  *
  * It will have no address space and will inherit the current
- * process's (that is, the kernel menu's) current directory.
+ * process's (that is, the kernel menu's) current directory. It has
+ * no file table either: runprogram gives it one with the console
+ * open, and fork gives it a copy of the parent's.
  */
 struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
+	int result;
 
 	proc = proc_create(name);
 	if (proc == NULL) {
 		return NULL;
 	}
 
-	proc->pid = pid_counter;
-	pid_counter++;
-
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
-	}
-	kfree(console_path);
-#endif // UW
-	  
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
@@ -299,6 +519,14 @@ proc_create_runprogram(const char *name)
 	V(proc_count_mutex);
 #endif // UW
 
+	lock_acquire(proctree_lock);
+	result = pid_alloc(proc);
+	lock_release(proctree_lock);
+	if (result) {
+		proc_destroy(proc);
+		return NULL;
+	}
+
 	return proc;
 }
 
@@ -325,9 +553,10 @@ proc_addthread(struct proc *proc, struct thread *t)
 
 /*
  * Remove a thread from its process. Either the thread or the process
- * might or might not be current.
+ * might or might not be current. Returns the number of threads still
+ * in the process, so the caller can tell if it was the last.
  */
-void
+unsigned
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
@@ -344,7 +573,7 @@ proc_remthread(struct thread *t)
 			threadarray_remove(&proc->p_threads, i);
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
-			return;
+			return num - 1;
 		}
 	}
 	/* Did not find it. */
@@ -353,9 +582,77 @@ proc_remthread(struct thread *t)
 }
 
 /*
- * Fetch the address space of the current process. Caution: it isn't
- * refcounted. If you implement multithreaded processes, make sure to
- * set up a refcount scheme or some other method to make this safe.
+ * Interruptible sleeps. t_intrwchan is protected by p_lock; lock
+ * order is p_lock, then the wchan.
+ */
+int
+proc_sleepbegin(struct wchan *wc)
+{
+	struct proc *proc = curproc;
+	int result = 0;
+
+	spinlock_acquire(&proc->p_lock);
+	KASSERT(curthread->t_intrwchan == NULL);
+	if (proc->p_exiting) {
+		result = EINTR;
+	}
+	else {
+		curthread->t_intrwchan = wc;
+	}
+	spinlock_release(&proc->p_lock);
+	return result;
+}
+
+void
+proc_sleep(struct wchan *wc)
+{
+	KASSERT(curthread->t_intrwchan == wc);
+
+	/*
+	 * proc_interrupt sets p_exiting before it locks WC, so either
+	 * we see it here or it finds us asleep.
+	 */
+	if (curproc->p_exiting) {
+		wchan_unlock(wc);
+	}
+	else {
+		wchan_sleep(wc);
+	}
+}
+
+void
+proc_sleepend(void)
+{
+	struct proc *proc = curproc;
+
+	spinlock_acquire(&proc->p_lock);
+	curthread->t_intrwchan = NULL;
+	spinlock_release(&proc->p_lock);
+}
+
+void
+proc_interrupt(struct proc *proc)
+{
+	struct thread *t;
+	unsigned i, num;
+
+	KASSERT(proc->p_exiting);
+
+	spinlock_acquire(&proc->p_lock);
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		t = threadarray_get(&proc->p_threads, i);
+		if (t->t_intrwchan != NULL) {
+			wchan_wakethread(t->t_intrwchan, t);
+		}
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Fetch the address space of the current process. It isn't
+ * refcounted; that's safe because only the last thread to leave a
+ * process destroys the address space (see sys_thread_exit).
  */
 struct addrspace *
 curproc_getas(void)
@@ -123,6 +123,7 @@ boot(void)
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	futex_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
 
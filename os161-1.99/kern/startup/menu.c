@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
@@ -45,6 +46,15 @@
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-kmalloctrace.h"
+#include "opt-lockstat.h"
+#if OPT_LOCKSTAT
+#include <lockstat.h>
+#endif
+#include "opt-syscallstats.h"
+#if OPT_SYSCALLSTATS
+#include <syscallstats.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -393,6 +403,170 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_cpustats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printstats();
+
+	return 0;
+}
+
+/*
+ * Check that S is a decimal number small enough for atoi.
+ */
+static
+bool
+isdecimal(const char *s)
+{
+	size_t i;
+
+	for (i=0; s[i] != 0; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return false;
+		}
+	}
+	return i > 0 && i < 10;
+}
+
+/*
+ * Command for showing or setting the scheduler quantum of a priority
+ * level (or, for level SCHED_NLEVELS, the priority boost interval).
+ */
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int level, hardclocks, result;
+
+	if (nargs == 1) {
+		for (level=0; level<SCHED_NLEVELS; level++) {
+			kprintf("level %d: quantum %u hardclocks\n", level,
+				thread_getquantum(level));
+		}
+		kprintf("boost every %u hardclocks\n",
+			thread_getquantum(SCHED_NLEVELS));
+		return 0;
+	}
+	if (nargs != 3 || !isdecimal(args[1]) || !isdecimal(args[2])) {
+		kprintf("Usage: sq [level hardclocks]\n");
+		return EINVAL;
+	}
+
+	hardclocks = atoi(args[2]);
+	result = hardclocks <= 0 ? EINVAL :
+		thread_setquantum(atoi(args[1]), hardclocks);
+	if (result) {
+		kprintf("sq: level must be 0-%d and hardclocks positive\n",
+			SCHED_NLEVELS);
+		return result;
+	}
+	return 0;
+}
+
+#if OPT_KMALLOCTRACE
+/*
+ * Command for printing the top kmalloc callsites by live bytes.
+ */
+static
+int
+cmd_kheapcallers(int nargs, char **args)
+{
+	int num = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: kt [count]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		num = atoi(args[1]);
+		if (num <= 0) {
+			kprintf("Usage: kt [count]\n");
+			return EINVAL;
+		}
+	}
+
+	kheap_printcallers(num);
+
+	return 0;
+}
+#endif
+
+#if OPT_LOCKSTAT
+/*
+ * Command for printing the most contended locks, or zeroing the counts.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int num = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: lk [count | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			lockstat_reset();
+			return 0;
+		}
+		num = atoi(args[1]);
+		if (num <= 0) {
+			kprintf("Usage: lk [count | reset]\n");
+			return EINVAL;
+		}
+	}
+
+	lockstat_print(num);
+
+	return 0;
+}
+#endif
+
+#if OPT_SYSCALLSTATS
+/*
+ * Command for printing system call statistics, the latencies of one
+ * call (by name or number), or zeroing them.
+ */
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	int callno;
+
+	if (nargs > 2) {
+		kprintf("Usage: scs [call | reset]\n");
+		return EINVAL;
+	}
+	if (nargs == 1) {
+		syscallstats_print();
+		return 0;
+	}
+	if (!strcmp(args[1], "reset")) {
+		syscallstats_reset();
+		return 0;
+	}
+
+	if (args[1][0] >= '0' && args[1][0] <= '9') {
+		callno = atoi(args[1]);
+	}
+	else {
+		callno = syscallstats_lookup(args[1]);
+	}
+	if (callno < 0 || callno >= SCS_NCALLS) {
+		kprintf("scs: %s: No such system call\n", args[1]);
+		return EINVAL;
+	}
+	syscallstats_printcall(callno);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -462,6 +636,9 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test          (1)     ",
+	"[sy5] Spinlock benchmark            ",
+	"[sy6] Priority inheritance test     ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -515,6 +692,17 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_KMALLOCTRACE
+	"[kt] Kernel heap top callsites      ",
+#endif
+#if OPT_LOCKSTAT
+	"[lk] Lock contention stats          ",
+#endif
+#if OPT_SYSCALLSTATS
+	"[scs] System call stats             ",
+#endif
+	"[cs] CPU scheduler stats            ",
+	"[sq] Show/set scheduler quantum     ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -572,6 +760,17 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_KMALLOCTRACE
+	{ "kt",		cmd_kheapcallers },
+#endif
+#if OPT_LOCKSTAT
+	{ "lk",		cmd_lockstat },
+#endif
+#if OPT_SYSCALLSTATS
+	{ "scs",	cmd_syscallstats },
+#endif
+	{ "cs",		cmd_cpustats },
+	{ "sq",		cmd_quantum },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -589,6 +788,9 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwlocktest },
+	{ "sy5",	spinlockbench },
+	{ "sy6",	pitest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -1,60 +1,568 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <syscall.h>
+#include <copyinout.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <file.h>
+#include <pipe.h>
+
+/* Largest transfer whose size fits in the int return value. */
+#define RW_MAX ((size_t)0x7fffffff)
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
+ * File-related system calls.
  *
- * You will need to improve this implementation
+ * Descriptors index curproc->p_files; see <file.h> for how open files
+ * are shared and locked.
  */
 
+/* handler for open() system call */
 int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
 {
-  struct iovec iov;
+  char *path;
+  struct openfile *of;
+  int result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+
+  result = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (result) {
+    return result;
+  }
+
+  result = filetable_place(curproc->p_files, of, retval);
+  if (result) {
+    openfile_decref(of);
+    return result;
+  }
+  return 0;
+}
+
+/*
+ * Common code for the read and write family. Moves data between the
+ * user buffers in IOV and the file on FDESC. If POS is -1, the I/O
+ * happens at and advances the file's seek position, under of_lock;
+ * otherwise it happens at POS, leaving the seek position (and the
+ * lock) alone so that positional readers can run in parallel.
+ *
+ * IOV is consumed.
+ */
+static
+int
+file_rw(int fdesc, struct iovec *iov, unsigned iovcnt, off_t pos,
+	enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
   struct uio u;
+  struct stat st;
+  size_t nbytes;
+  unsigned i;
   int res;
 
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
+  /* the total has to fit in the return value */
+  nbytes = 0;
+  for (i=0; i<iovcnt; i++) {
+    if (iov[i].iov_len > RW_MAX - nbytes) {
+      return EINVAL;
+    }
+    nbytes += iov[i].iov_len;
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
 
-  /* set up a uio structure to refer to the user program's buffer (ubuf) */
-  iov.iov_ubase = ubuf;
-  iov.iov_len = nbytes;
-  u.uio_iov = &iov;
-  u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
+  res = filetable_get(curproc->p_files, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  if (of->of_accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY)) {
+    openfile_decref(of);
+    return EBADF;
+  }
+
+  /* set up a uio structure to refer to the user program's buffers */
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_offset = 0;  /* not needed for devices */
   u.uio_resid = nbytes;
   u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
+  u.uio_rw = rw;
   u.uio_space = curproc->p_addrspace;
 
-  res = VOP_WRITE(curproc->console,&u);
-  if (res) {
+  if (pos != -1) {
+    if (!of->of_seekable) {
+      openfile_decref(of);
+      return ESPIPE;
+    }
+    if (pos < 0) {
+      openfile_decref(of);
+      return EINVAL;
+    }
+    u.uio_offset = pos;
+    res = (rw == UIO_READ) ? VOP_READ(of->of_vnode, &u) :
+                             VOP_WRITE(of->of_vnode, &u);
+  }
+  else if (!of->of_seekable) {
+    res = (rw == UIO_READ) ? VOP_READ(of->of_vnode, &u) :
+                             VOP_WRITE(of->of_vnode, &u);
+  }
+  else {
+    lock_acquire(of->of_lock);
+    if (rw == UIO_WRITE && of->of_append) {
+      res = VOP_STAT(of->of_vnode, &st);
+      if (res) {
+        lock_release(of->of_lock);
+        openfile_decref(of);
+        return res;
+      }
+      of->of_offset = st.st_size;
+    }
+    u.uio_offset = of->of_offset;
+    res = (rw == UIO_READ) ? VOP_READ(of->of_vnode, &u) :
+                             VOP_WRITE(of->of_vnode, &u);
+    /* a partial transfer still moves the seek position */
+    of->of_offset = u.uio_offset;
+    lock_release(of->of_lock);
+  }
+  openfile_decref(of);
+
+  if (res && u.uio_resid == nbytes) {
     return res;
   }
 
-  /* pass back the number of bytes actually written */
+  /* pass back the number of bytes actually transferred */
   *retval = nbytes - u.uio_resid;
   KASSERT(*retval >= 0);
   return 0;
 }
+
+/*
+ * Common code for readv, writev and friends: copy in the user's iovec
+ * array and do the I/O in one go.
+ */
+static
+int
+file_rwv(int fdesc, const_userptr_t uiov, int iovcnt, off_t pos,
+	 enum uio_rw rw, int *retval)
+{
+  struct iovec *iov;
+  int res;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+  iov = kmalloc(iovcnt * sizeof(struct iovec));
+  if (iov == NULL) {
+    return ENOMEM;
+  }
+  /* the kernel's iovec has the same layout as the user's */
+  res = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+  if (res == 0) {
+    res = file_rw(fdesc, iov, iovcnt, pos, rw, retval);
+  }
+  kfree(iov);
+  return res;
+}
+
+/* handler for read() system call */
+int
+sys_read(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  struct iovec iov;
+
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_rw(fdesc, &iov, 1, -1, UIO_READ, retval);
+}
+
+/* handler for write() system call */
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  struct iovec iov;
+
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_rw(fdesc, &iov, 1, -1, UIO_WRITE, retval);
+}
+
+/* handler for pread() system call */
+int
+sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  struct iovec iov;
+
+  if (pos == -1) {
+    /* would mean "use the seek position" to file_rw */
+    return EINVAL;
+  }
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_rw(fdesc, &iov, 1, pos, UIO_READ, retval);
+}
+
+/* handler for pwrite() system call */
+int
+sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  struct iovec iov;
+
+  if (pos == -1) {
+    return EINVAL;
+  }
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_rw(fdesc, &iov, 1, pos, UIO_WRITE, retval);
+}
+
+/* handler for readv() system call */
+int
+sys_readv(int fdesc, const_userptr_t uiov, int iovcnt, int *retval)
+{
+  return file_rwv(fdesc, uiov, iovcnt, -1, UIO_READ, retval);
+}
+
+/* handler for writev() system call */
+int
+sys_writev(int fdesc, const_userptr_t uiov, int iovcnt, int *retval)
+{
+  return file_rwv(fdesc, uiov, iovcnt, -1, UIO_WRITE, retval);
+}
+
+/* handler for lseek() system call */
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int res;
+
+  res = filetable_get(curproc->p_files, fdesc, &of);
+  if (res) {
+    return res;
+  }
+  if (!of->of_seekable) {
+    openfile_decref(of);
+    return ESPIPE;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    res = VOP_STAT(of->of_vnode, &st);
+    if (res) {
+      goto out;
+    }
+    newpos = st.st_size + pos;
+    break;
+  default:
+    res = EINVAL;
+    goto out;
+  }
+
+  res = VOP_TRYSEEK(of->of_vnode, newpos);
+  if (res == 0) {
+    of->of_offset = newpos;
+    *retval = newpos;
+  }
+
+ out:
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return res;
+}
+
+/* handler for pipe() system call */
+int
+sys_pipe(userptr_t ufds)
+{
+  struct vnode *rvn, *wvn;
+  struct openfile *rof, *wof;
+  int fds[2];
+  int res;
+
+  res = pipe_create(PIPE_SIZE, &rvn, &wvn);
+  if (res) {
+    return res;
+  }
+  res = openfile_create(rvn, O_RDONLY, &rof);
+  if (res) {
+    vfs_close(rvn);
+    vfs_close(wvn);
+    return res;
+  }
+  res = openfile_create(wvn, O_WRONLY, &wof);
+  if (res) {
+    openfile_decref(rof);
+    vfs_close(wvn);
+    return res;
+  }
+
+  res = filetable_place(curproc->p_files, rof, &fds[0]);
+  if (res) {
+    openfile_decref(rof);
+    openfile_decref(wof);
+    return res;
+  }
+  res = filetable_place(curproc->p_files, wof, &fds[1]);
+  if (res) {
+    filetable_close(curproc->p_files, fds[0]);
+    openfile_decref(wof);
+    return res;
+  }
+
+  res = copyout(fds, ufds, sizeof(fds));
+  if (res) {
+    filetable_close(curproc->p_files, fds[0]);
+    filetable_close(curproc->p_files, fds[1]);
+    return res;
+  }
+  return 0;
+}
+
+/* handler for close() system call */
+int
+sys_close(int fdesc)
+{
+  return filetable_close(curproc->p_files, fdesc);
+}
+
+/* handler for dup2() system call */
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of;
+  int res;
+
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+  res = filetable_get(curproc->p_files, oldfd, &of);
+  if (res) {
+    return res;
+  }
+  if (oldfd == newfd) {
+    openfile_decref(of);
+  }
+  else {
+    /* our reference moves into the table */
+    filetable_setfd(curproc->p_files, newfd, of);
+  }
+  *retval = newfd;
+  return 0;
+}
+
+/*
+ * handler for fcntl() system call
+ *
+ * Only the per-descriptor flags (F_GETFD/F_SETFD, i.e. FD_CLOEXEC)
+ * are supported.
+ */
+int
+sys_fcntl(int fdesc, int cmd, int arg, int *retval)
+{
+  switch (cmd) {
+  case F_GETFD:
+    return filetable_getflags(curproc->p_files, fdesc, retval);
+  case F_SETFD:
+    if ((arg & ~FD_CLOEXEC) != 0) {
+      return EINVAL;
+    }
+    *retval = 0;
+    return filetable_setflags(curproc->p_files, fdesc, arg);
+  default:
+    return EINVAL;
+  }
+}
+
+/*
+ * Bounce buffers for copy_file_range. They're big enough to need
+ * whole pages, which dumbvm never gives back, so rather than
+ * allocating one per call we keep the ones we've made on a free list
+ * (linked through their first word) and reuse them.
+ */
+#define COPY_CHUNK (64*1024)
+
+static struct spinlock copybuf_lock = SPINLOCK_INITIALIZER;
+static void *copybuf_free;
+
+static
+void *
+copybuf_get(void)
+{
+  void *buf;
+
+  spinlock_acquire(&copybuf_lock);
+  buf = copybuf_free;
+  if (buf != NULL) {
+    copybuf_free = *(void **)buf;
+  }
+  spinlock_release(&copybuf_lock);
+
+  if (buf == NULL) {
+    buf = kmalloc(COPY_CHUNK);
+  }
+  return buf;
+}
+
+static
+void
+copybuf_put(void *buf)
+{
+  spinlock_acquire(&copybuf_lock);
+  *(void **)buf = copybuf_free;
+  copybuf_free = buf;
+  spinlock_release(&copybuf_lock);
+}
+
+/*
+ * handler for copy_file_range() system call
+ *
+ * Copy up to LEN bytes from the seek position of INFD to the seek
+ * position of OUTFD, advancing both, without the data ever leaving
+ * the kernel. Returns the number of bytes copied; 0 means INFD was
+ * at EOF. INFD must be seekable (ESPIPE otherwise), so that input
+ * read but not written can be left unconsumed.
+ */
+int
+sys_copy_file_range(int infd, int outfd, size_t len, int *retval)
+{
+  struct openfile *in, *out, *first, *second;
+  struct iovec iov;
+  struct uio u;
+  struct stat st;
+  void *buf;
+  off_t inpos, outpos;
+  size_t done, n, got, wrote;
+  int res;
+
+  if (len > RW_MAX) {
+    len = RW_MAX;
+  }
+
+  res = filetable_get(curproc->p_files, infd, &in);
+  if (res) {
+    return res;
+  }
+  res = filetable_get(curproc->p_files, outfd, &out);
+  if (res) {
+    openfile_decref(in);
+    return res;
+  }
+  if (in->of_accmode == O_WRONLY || out->of_accmode == O_RDONLY) {
+    res = EBADF;
+    goto out;
+  }
+  if (in == out) {
+    /* one seek position can't be both source and destination */
+    res = EINVAL;
+    goto out;
+  }
+  if (!in->of_seekable) {
+    /*
+     * A short write is undone by moving the input back, which
+     * can't be done to a pipe or device: the bytes would be lost.
+     */
+    res = ESPIPE;
+    goto out;
+  }
+
+  buf = copybuf_get();
+  if (buf == NULL) {
+    res = ENOMEM;
+    goto out;
+  }
+
+  /* Lock both seek positions, in address order to avoid deadlock. */
+  first = in < out ? in : out;
+  second = in < out ? out : in;
+  if (first->of_seekable) {
+    lock_acquire(first->of_lock);
+  }
+  if (second->of_seekable) {
+    lock_acquire(second->of_lock);
+  }
+
+  if (out->of_seekable && out->of_append) {
+    res = VOP_STAT(out->of_vnode, &st);
+    if (res) {
+      goto unlock;
+    }
+    out->of_offset = st.st_size;
+  }
+  inpos = in->of_offset;
+  outpos = out->of_offset;
+
+  done = 0;
+  while (done < len) {
+    n = len - done < COPY_CHUNK ? len - done : COPY_CHUNK;
+
+    uio_kinit(&iov, &u, buf, n, inpos, UIO_READ);
+    res = VOP_READ(in->of_vnode, &u);
+    got = n - u.uio_resid;
+    if (res || got == 0) {
+      break;
+    }
+    inpos += got;
+
+    uio_kinit(&iov, &u, buf, got, outpos, UIO_WRITE);
+    res = VOP_WRITE(out->of_vnode, &u);
+    wrote = got - u.uio_resid;
+    outpos += wrote;
+    done += wrote;
+    if (wrote < got) {
+      /* leave the input just past what actually got written */
+      inpos -= got - wrote;
+      break;
+    }
+  }
+
+  in->of_offset = inpos;
+  if (out->of_seekable) {
+    out->of_offset = outpos;
+  }
+  if (done > 0) {
+    res = 0;
+    *retval = done;
+  }
+
+ unlock:
+  if (second->of_seekable) {
+    lock_release(second->of_lock);
+  }
+  if (first->of_seekable) {
+    lock_release(first->of_lock);
+  }
+  copybuf_put(buf);
+ out:
+  openfile_decref(out);
+  openfile_decref(in);
+  return res;
+}
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Futexes: sleeping and waking on a word of user memory.
+ *
+ * A user-level lock or semaphore keeps its state in an int and only
+ * calls into the kernel when it has to wait (futex_wait) or when
+ * someone might be waiting (futex_wake). futex_wait checks that the
+ * word still holds the value the caller last saw before sleeping, so
+ * a wakeup between the caller's check and its sleep isn't lost.
+ *
+ * Waiters are hashed by the physical address of the word, so two
+ * processes sharing the memory would find each other. Each bucket has
+ * a spinlock, protecting its waiter list, and one wait channel for
+ * all its waiters; futex_wake picks out the ones for its address and
+ * wakes them individually.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <syscall.h>
+
+#define FUTEX_NBUCKETS 64
+
+/* A sleeping futex_wait. Lives on the sleeper's stack. */
+struct futex_waiter {
+	paddr_t fw_addr;
+	struct thread *fw_thread;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_waiter *fb_waiters;
+	struct wchan *fb_wchan;
+};
+
+static struct futex_bucket futex_table[FUTEX_NBUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_waiters = NULL;
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+/*
+ * Find the physical address of the futex word at user address UADDR
+ * in the current process.
+ */
+static
+int
+futex_lookup(userptr_t uaddr, paddr_t *ret)
+{
+	struct addrspace *as;
+	vaddr_t va = (vaddr_t)uaddr;
+
+	if (va % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	if (va >= USERSPACETOP) {
+		return EFAULT;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_vtop(as, va, ret);
+}
+
+static
+struct futex_bucket *
+futex_hash(paddr_t pa)
+{
+	return &futex_table[(pa / sizeof(int)) % FUTEX_NBUCKETS];
+}
+
+/*
+ * Sleep until woken by futex_wake, provided the word at UADDR still
+ * holds EXPECTED. Returns EAGAIN if it doesn't, and EINTR if the
+ * process is exiting.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int expected)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **fwp;
+	paddr_t pa;
+	int result;
+
+	result = futex_lookup(uaddr, &pa);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(pa);
+
+	result = proc_sleepbegin(fb->fb_wchan);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Read the word through its kernel mapping, so we can look at
+	 * it with the bucket lock held without risking a page fault.
+	 * A waker changes the word before taking the bucket lock, so
+	 * either we see the change or it sees us on the list.
+	 */
+	spinlock_acquire(&fb->fb_lock);
+	if (*(volatile int *)PADDR_TO_KVADDR(pa) != expected) {
+		spinlock_release(&fb->fb_lock);
+		proc_sleepend();
+		return EAGAIN;
+	}
+
+	fw.fw_addr = pa;
+	fw.fw_thread = curthread;
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+
+	/* futex_wake takes us off the list before waking us. */
+	wchan_lock(fb->fb_wchan);
+	spinlock_release(&fb->fb_lock);
+	proc_sleep(fb->fb_wchan);
+	proc_sleepend();
+
+	/*
+	 * If we're still on the list, it wasn't futex_wake that woke
+	 * us, but _exit; get off.
+	 */
+	result = 0;
+	spinlock_acquire(&fb->fb_lock);
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		if (*fwp == &fw) {
+			*fwp = fw.fw_next;
+			result = EINTR;
+			break;
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return result;
+}
+
+/*
+ * Wake up to COUNT threads waiting on the word at UADDR. Returns the
+ * number woken.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int32_t *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	paddr_t pa;
+	int result, woken;
+
+	if (count < 0) {
+		return EINVAL;
+	}
+	result = futex_lookup(uaddr, &pa);
+	if (result) {
+		return result;
+	}
+	fb = futex_hash(pa);
+
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < count) {
+		fw = *fwp;
+		if (fw->fw_addr != pa) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		/*
+		 * Holding fb_lock means the waiter is asleep (it locked
+		 * the channel before letting go of fb_lock), unless its
+		 * process is exiting and it didn't sleep or was woken
+		 * already. Only count the ones we really woke.
+		 */
+		if (wchan_wakethread(fb->fb_wchan, fw->fw_thread)) {
+			woken++;
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
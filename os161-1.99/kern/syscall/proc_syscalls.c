@@ -11,62 +11,166 @@
 #include <copyinout.h>
 #include <kern/fcntl.h>
 #include <synch.h>
+#include <file.h>
 #include <vfs.h>
 #include <machine/trapframe.h>
 #include <limits.h>
 #include "opt-A2.h"
 
-  /* this implementation of sys__exit does not do anything with the exit code */
-  /* this needs to be fixed to get exit() and waitpid() working properly */
-  // :)
+/*
+ * _exit: tell the process's other threads to go and leave. They
+ * notice on their way back to user mode, in mips_trap; any asleep in
+ * the kernel get woken, and their waits fail with EINTR, so they get
+ * there. The last thread out
+ * destroys the address space and hands the rest to proc_exit. A
+ * parent that's still around gets a zombie holding the exit code,
+ * which waitpid (or the parent's own exit) frees.
+ */
 
 void sys__exit(int exitcode) {
 
+  struct proc *p = curproc;
+  bool first;
+
+  DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+
+  /* If two threads race to _exit, the first one's code wins. */
+  spinlock_acquire(&p->p_lock);
+  first = !p->p_exiting;
+  if (first) {
+    p->p_exiting = true;
+    p->p_exitcode = exitcode;
+  }
+  spinlock_release(&p->p_lock);
+
+  if (first) {
+    /* Wake siblings in pipes, futexes, and so on... */
+    proc_interrupt(p);
+    /* ...and in waitpid. */
+    lock_acquire(proctree_lock);
+    cv_broadcast(p->p_waitcv, proctree_lock);
+    lock_release(proctree_lock);
+  }
+
+  sys_thread_exit();
+}
+
+/*
+ * thread_exit: this thread leaves its process. If it was the last
+ * one, the process exits with p_exitcode, which is 0 unless someone
+ * called _exit.
+ */
+void
+sys_thread_exit(void)
+{
   struct addrspace *as;
   struct proc *p = curproc;
-  /* for now, just include this to keep the compiler from complaining about
-     an unused variable */
-  if (p->parent) {
-      lock_acquire(p->parent->lk);
-      lock_acquire(p->lk);
-      p->exit_code = exitcode;
-      p->killed = true;
-      lock_release(p->lk);
-      cv_signal(p->terminating, p->parent->lk);
-      lock_release(p->parent->lk);
-
-      /* detach this thread from its process */
-      /* note: curproc cannot be used after this call */
-      proc_remthread(curthread);
-      thread_exit();
-  }
-
-      DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
-
-      KASSERT(curproc->p_addrspace != NULL);
-      as_deactivate();
-      /*
-       * clear p_addrspace before calling as_destroy. Otherwise if
-       * as_destroy sleeps (which is quite possible) when we
-       * come back we'll be calling as_activate on a
-       * half-destroyed address space. This tends to be
-       * messily fatal.
-       */
-      as = curproc_setas(NULL);
-      as_destroy(as);
+  unsigned left;
 
-      /* detach this thread from its process */
-      /* note: curproc cannot be used after this call */
-      proc_remthread(curthread);
+  if (curthread->t_ustack >= 0) {
+    as_release_threadstack(p->p_addrspace, curthread->t_ustack);
+    curthread->t_ustack = -1;
+  }
 
-      /* if this is the last user process in the system, proc_destroy()
-         will wake up the kernel menu thread */
-      proc_destroy(p);
+  as_deactivate();
+
+  /* detach this thread from its process */
+  /* note: curproc cannot be used after this call */
+  left = proc_remthread(curthread);
+
+  if (left == 0) {
+    /*
+     * Nobody else can be using the address space now. As before,
+     * clear p_addrspace before calling as_destroy, in case it
+     * sleeps.
+     */
+    spinlock_acquire(&p->p_lock);
+    as = p->p_addrspace;
+    p->p_addrspace = NULL;
+    spinlock_release(&p->p_lock);
+    if (as != NULL) {
+      /* a spawned child that failed early may not have one */
+      as_destroy(as);
+    }
 
-      thread_exit();
+    /*
+     * Free everything else, leaving at most a zombie for the parent.
+     * If this is the last user process in the system, this will wake
+     * up the kernel menu thread.
+     */
+    proc_exit(p, p->p_exitcode);
+  }
+
+  thread_exit();
 
   /* thread_exit() does not return, so we should never get here */
-  panic("return from thread_exit in sys_exit\n");
+  panic("return from thread_exit in sys_thread_exit\n");
+}
+
+/*
+ * __thread_create: start a new thread in this process, on a stack of
+ * its own. It enters user mode at ENTRY with FUNC and ARG as its two
+ * arguments; libc's ENTRY calls FUNC(ARG) and then thread_exit.
+ */
+
+struct uthread_args {
+  vaddr_t ua_entry;
+  vaddr_t ua_func;
+  vaddr_t ua_arg;
+  vaddr_t ua_stackptr;
+  int ua_slot;
+};
+
+static
+void
+uthread_start(void *data1, unsigned long data2)
+{
+  struct uthread_args ua;
+
+  (void)data2;
+
+  ua = *(struct uthread_args *)data1;
+  kfree(data1);
+  curthread->t_ustack = ua.ua_slot;
+
+  if (curproc->p_exiting) {
+    /* the process was told to exit while we were being made */
+    sys_thread_exit();
+  }
+
+  enter_new_process((int)ua.ua_func, (userptr_t)ua.ua_arg,
+                    ua.ua_stackptr, ua.ua_entry);
+  panic("enter_new_process returned\n");
+}
+
+int
+sys___thread_create(userptr_t entry, userptr_t func, userptr_t arg)
+{
+  struct addrspace *as = curproc->p_addrspace;
+  struct uthread_args *ua;
+  int result;
+
+  ua = kmalloc(sizeof(*ua));
+  if (ua == NULL) {
+    return ENOMEM;
+  }
+  ua->ua_entry = (vaddr_t)entry;
+  ua->ua_func = (vaddr_t)func;
+  ua->ua_arg = (vaddr_t)arg;
+
+  result = as_define_threadstack(as, &ua->ua_slot, &ua->ua_stackptr);
+  if (result) {
+    kfree(ua);
+    return result;
+  }
+
+  result = thread_fork(curthread->t_name, curproc, uthread_start, ua, 0);
+  if (result) {
+    as_release_threadstack(as, ua->ua_slot);
+    kfree(ua);
+    return result;
+  }
+  return 0;
 }
 
 
@@ -80,7 +184,13 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
-/* stub handler for waitpid() system call                */
+/*
+ * waitpid: wait for child PID, or any child if PID is WAIT_ANY, to
+ * exit, and collect its exit status. With WNOHANG, return 0 instead
+ * of waiting. Exited children queue up on their parent in the order
+ * they exited, so WAIT_ANY takes the first of them in O(1). The
+ * child's zombie is freed here.
+ */
 
 int
 sys_waitpid(pid_t pid,
@@ -88,70 +198,69 @@ sys_waitpid(pid_t pid,
 	    int options,
 	    pid_t *retval)
 {
+  struct proc *child;
   int exitstatus;
   int result;
 
-  /* this is just a stub implementation that always reports an
-     exit status of 0, regardless of the actual exit status of
-     the specified process.
-     In fact, this will return 0 even if the specified process
-     is still running, and even if it never existed in the first place.
-
-     Fix this!
-  */
-
-    lock_acquire(curproc->lk);
-    bool isChild = false;
-    for (unsigned int i = 0; i < array_num(curproc->children); ++i) {
-        struct proc *child = array_get(curproc->children, i);
-        lock_acquire(child->lk);
-        if (pid == child->pid) {
-            isChild = true;
-            if (child->parent->pid != curproc->pid) {
-                lock_release(child->lk);
-                lock_release(curproc->lk);
-                return ECHILD;
-            }
-            lock_release(child->lk);
-            break;
-        }
-        lock_release(child->lk);
+  if ((options & ~WNOHANG) != 0) {
+    return(EINVAL);
+  }
+  if (pid != WAIT_ANY && pid < PID_MIN) {
+    /* No process groups */
+    return(EINVAL);
+  }
+
+  lock_acquire(proctree_lock);
+  for (;;) {
+    if (pid == WAIT_ANY) {
+      if (curproc->p_children == NULL) {
+        lock_release(proctree_lock);
+        return ECHILD;
+      }
+      child = curproc->p_exited;
     }
-    if (isChild == false) {
-        lock_release(curproc->lk);
-        *retval = -1;
+    else {
+      child = proc_lookup(pid);
+      if (child == NULL) {
+        lock_release(proctree_lock);
         return ESRCH;
+      }
+      if (child->parent != curproc) {
+        lock_release(proctree_lock);
+        return ECHILD;
+      }
+      if (!child->killed) {
+        child = NULL;
+      }
     }
-
-
-    for (unsigned int i = 0; i < array_num(curproc->children); ++i) {
-        struct proc *child = array_get(curproc->children, i);
-        lock_acquire(child->lk);
-        if (pid == child->pid) {
-            if (child->killed) {
-                exitstatus = _MKWAIT_EXIT(child->exit_code);
-                lock_release(child->lk);
-                break;
-            }
-            while(!child->killed) {
-                lock_release(child->lk);
-                cv_wait(child->terminating, curproc->lk);
-            }
-            exitstatus = _MKWAIT_EXIT(child->exit_code);
-            break;
-        }
-        lock_release(child->lk);
+    if (child != NULL) {
+      break;
     }
+    if (options & WNOHANG) {
+      lock_release(proctree_lock);
+      *retval = 0;
+      return(0);
+    }
+    if (curproc->p_exiting) {
+      /* another thread called _exit; see sys__exit */
+      lock_release(proctree_lock);
+      return EINTR;
+    }
+    cv_wait(curproc->p_waitcv, proctree_lock);
+  }
+  exitstatus = _MKWAIT_EXIT(child->exit_code);
+  pid = child->pid;
 
-    lock_release(curproc->lk);
+  /* Reap the zombie. */
+  proc_unlink(child);
+  lock_release(proctree_lock);
+  proc_destroy(child);
 
-  if (options != 0) {
-    return(EINVAL);
-  }
-  /* for now, just pretend the exitstatus is 0 */
-  result = copyout((void *)&exitstatus,status,sizeof(int));
-  if (result) {
-    return(result);
+  if (status != NULL) {
+    result = copyout((void *)&exitstatus,status,sizeof(int));
+    if (result) {
+      return(result);
+    }
   }
   *retval = pid;
   return(0);
@@ -162,13 +271,12 @@ sys_fork(struct trapframe *tf, pid_t *ret) {
   struct proc *child = proc_create_runprogram(curproc->p_name);
   struct trapframe *tf_temp;
   struct addrspace *as_temp = NULL;
+  pid_t pid;
   if (child == NULL) {
       return ENOMEM;
   }
 
-  child->parent = curproc;
   child->exit_code = -1;
-  array_add(curproc->children, child, NULL);
 
   int res;
 
@@ -178,6 +286,14 @@ sys_fork(struct trapframe *tf, pid_t *ret) {
     return ENOMEM;
   }
 
+  /* The child shares our open files, seek positions and all. */
+  res = filetable_copy(curproc->p_files, &child->p_files);
+  if (res) {
+    as_destroy(as_temp);
+    proc_destroy(child);
+    return res;
+  }
+
 
   tf_temp = kmalloc(sizeof(struct trapframe));
   if (tf_temp == NULL) {
@@ -194,13 +310,27 @@ sys_fork(struct trapframe *tf, pid_t *ret) {
 
   spinlock_release(&child->p_lock);
 
+  /* Link it in before it can run, in case it exits right away. */
+  lock_acquire(proctree_lock);
+  proc_addchild(curproc, child);
+  lock_release(proctree_lock);
+
+  /*
+   * Once it runs, it can exit and be reaped by another of our
+   * threads at any moment, so don't look at it afterwards.
+   */
+  pid = child->pid;
+
   res = thread_fork(curthread->t_name, child, (void *)&enter_forked_process, tf_temp, 0);
   if (res) {
+      lock_acquire(proctree_lock);
+      proc_unlink(child);
+      lock_release(proctree_lock);
       kfree(tf_temp);
       proc_destroy(child);
       return ENOMEM;
   }
-  *ret = child->pid;
+  *ret = pid;
 
   return 0;
 
@@ -214,6 +344,17 @@ sys_execv(char *progname, char **args) {
     vaddr_t entrypoint, stackptr;
     int result;
 
+    /*
+     * Replacing the address space would pull it out from under
+     * any other threads, so only a lone thread may execv.
+     */
+    spinlock_acquire(&curproc->p_lock);
+    result = threadarray_num(&curproc->p_threads) > 1 ? EBUSY : 0;
+    spinlock_release(&curproc->p_lock);
+    if (result) {
+        return result;
+    }
+
     // Count the number of arguments
     int args_many = 0;
     while (args[args_many] != NULL) {
@@ -256,6 +397,9 @@ sys_execv(char *progname, char **args) {
     curproc_setas(as);
     as_activate();
 
+    /* Any thread stack we were on went with the old address space. */
+    curthread->t_ustack = -1;
+
     /* Load the executable. */
     result = load_elf(v, &entrypoint);
     if (result) {
@@ -267,6 +411,9 @@ sys_execv(char *progname, char **args) {
     /* Done with the file now. */
     vfs_close(v);
 
+    /* There's no going back now; drop the close-on-exec files. */
+    filetable_closeexec(curproc->p_files);
+
     /* Define the user stack in the address space */
     result = as_define_stack(as, &stackptr);
     if (result) {
@@ -315,3 +462,296 @@ sys_execv(char *progname, char **args) {
     panic("enter_new_process returned\n");
     return EINVAL;
 }
+
+
+/*
+ * spawn: start PROGNAME running with ARGS in a new child process,
+ * without ever copying our address space as fork+execv would.
+ *
+ * If FDS is NULL the child inherits all our file descriptors but the
+ * close-on-exec ones, as with fork and execv. Otherwise it gets only
+ * NFDS of them: its descriptor I is our FDS[I], or closed if FDS[I]
+ * is -1.
+ *
+ * The program is opened here, so a bad path fails the call; but the
+ * ELF is loaded by the child, into its own fresh address space, and
+ * if that goes wrong the child exits with status 127 (as posix_spawn
+ * specifies).
+ */
+
+struct spawn_args {
+  struct vnode *sa_vnode;	/* the program, open */
+  int sa_argc;
+  char *sa_argbuf;		/* argument strings, packed */
+  size_t sa_arglen;		/* bytes used in sa_argbuf */
+};
+
+static
+void
+spawn_args_destroy(struct spawn_args *sa)
+{
+  if (sa->sa_vnode != NULL) {
+    vfs_close(sa->sa_vnode);
+  }
+  kfree(sa->sa_argbuf);
+  kfree(sa);
+}
+
+/*
+ * Copy in the NULL-terminated argument vector UARGS, packing the
+ * strings end to end. The buffer starts small and doubles as
+ * needed, since big kmallocs take whole pages.
+ */
+static
+int
+spawn_copyinargs(userptr_t uargs, struct spawn_args *sa)
+{
+  userptr_t uarg;
+  char *newbuf;
+  size_t bufsize, got;
+  int result;
+
+  bufsize = 256;
+  sa->sa_argbuf = kmalloc(bufsize);
+  if (sa->sa_argbuf == NULL) {
+    return ENOMEM;
+  }
+  sa->sa_argc = 0;
+  sa->sa_arglen = 0;
+
+  for (;;) {
+    result = copyin(uargs, &uarg, sizeof(uarg));
+    if (result) {
+      return result;
+    }
+    if (uarg == NULL) {
+      return 0;
+    }
+
+    for (;;) {
+      result = copyinstr(uarg, sa->sa_argbuf + sa->sa_arglen,
+                         bufsize - sa->sa_arglen, &got);
+      if (result != ENAMETOOLONG) {
+        break;
+      }
+      if (bufsize >= ARG_MAX) {
+        return E2BIG;
+      }
+      newbuf = kmalloc(bufsize * 2);
+      if (newbuf == NULL) {
+        return ENOMEM;
+      }
+      memcpy(newbuf, sa->sa_argbuf, sa->sa_arglen);
+      kfree(sa->sa_argbuf);
+      sa->sa_argbuf = newbuf;
+      bufsize *= 2;
+    }
+    if (result) {
+      return result;
+    }
+    sa->sa_arglen += got;
+    sa->sa_argc++;
+    uargs += sizeof(userptr_t);
+  }
+}
+
+/*
+ * First code run by a spawned child: load the program, put the
+ * arguments on its stack, and go.
+ */
+static
+void
+spawn_start(void *data1, unsigned long data2)
+{
+  struct spawn_args *sa = data1;
+  struct addrspace *as;
+  vaddr_t entrypoint, stackptr, argbase;
+  vaddr_t *argv;
+  size_t pos;
+  int i, result;
+
+  (void)data2;
+
+  as = as_create();
+  if (as == NULL) {
+    goto fail;
+  }
+  curproc_setas(as);
+  as_activate();
+
+  result = load_elf(sa->sa_vnode, &entrypoint);
+  if (result) {
+    goto fail;
+  }
+  vfs_close(sa->sa_vnode);
+  sa->sa_vnode = NULL;
+
+  result = as_define_stack(as, &stackptr);
+  if (result) {
+    goto fail;
+  }
+
+  /* The strings go at the top of the stack, with argv below them. */
+  argv = kmalloc((sa->sa_argc + 1) * sizeof(vaddr_t));
+  if (argv == NULL) {
+    goto fail;
+  }
+  stackptr -= ROUNDUP(sa->sa_arglen, 8);
+  argbase = stackptr;
+  result = copyout(sa->sa_argbuf, (userptr_t)argbase, sa->sa_arglen);
+  if (result) {
+    kfree(argv);
+    goto fail;
+  }
+  pos = 0;
+  for (i = 0; i < sa->sa_argc; i++) {
+    argv[i] = argbase + pos;
+    pos += strlen(sa->sa_argbuf + pos) + 1;
+  }
+  argv[sa->sa_argc] = 0;
+  stackptr -= ROUNDUP((sa->sa_argc + 1) * sizeof(vaddr_t), 8);
+  result = copyout(argv, (userptr_t)stackptr,
+                   (sa->sa_argc + 1) * sizeof(vaddr_t));
+  kfree(argv);
+  if (result) {
+    goto fail;
+  }
+
+  i = sa->sa_argc;
+  spawn_args_destroy(sa);
+
+  /* Warp to user mode. */
+  enter_new_process(i, (userptr_t)stackptr, stackptr, entrypoint);
+  panic("enter_new_process returned\n");
+
+ fail:
+  spawn_args_destroy(sa);
+  sys__exit(127);
+}
+
+/*
+ * Give CHILD the descriptors it gets under spawn's rules.
+ */
+static
+int
+spawn_files(struct proc *child, userptr_t ufds, int nfds)
+{
+  struct openfile *of;
+  int *fds;
+  int i, result;
+
+  if (ufds == NULL) {
+    /* spawn is an exec, so close-on-exec files stay behind */
+    result = filetable_copy(curproc->p_files, &child->p_files);
+    if (result == 0) {
+      filetable_closeexec(child->p_files);
+    }
+    return result;
+  }
+  if (nfds < 0 || nfds > OPEN_MAX) {
+    return EINVAL;
+  }
+
+  child->p_files = filetable_create();
+  if (child->p_files == NULL) {
+    return ENOMEM;
+  }
+  if (nfds == 0) {
+    return 0;
+  }
+
+  fds = kmalloc(nfds * sizeof(int));
+  if (fds == NULL) {
+    return ENOMEM;
+  }
+  result = copyin(ufds, fds, nfds * sizeof(int));
+  for (i = 0; result == 0 && i < nfds; i++) {
+    if (fds[i] == -1) {
+      continue;
+    }
+    result = filetable_get(curproc->p_files, fds[i], &of);
+    if (result == 0) {
+      filetable_setfd(child->p_files, i, of);
+    }
+  }
+  kfree(fds);
+  return result;
+}
+
+int
+sys_spawn(userptr_t uprogname, userptr_t uargs, userptr_t ufds, int nfds,
+          pid_t *retval)
+{
+  struct spawn_args *sa;
+  struct proc *child;
+  char *progname;
+  pid_t pid;
+  int result;
+
+  sa = kmalloc(sizeof(*sa));
+  if (sa == NULL) {
+    return ENOMEM;
+  }
+  sa->sa_vnode = NULL;
+  sa->sa_argbuf = NULL;
+
+  result = spawn_copyinargs(uargs, sa);
+  if (result) {
+    spawn_args_destroy(sa);
+    return result;
+  }
+
+  progname = kmalloc(PATH_MAX);
+  if (progname == NULL) {
+    spawn_args_destroy(sa);
+    return ENOMEM;
+  }
+  result = copyinstr(uprogname, progname, PATH_MAX, NULL);
+  if (result == 0) {
+    child = proc_create_runprogram(progname);
+    if (child == NULL) {
+      result = ENOMEM;
+    }
+  }
+  if (result == 0) {
+    /* vfs_open may destroy the path, so do it after naming the child */
+    result = vfs_open(progname, O_RDONLY, 0, &sa->sa_vnode);
+    if (result) {
+      proc_destroy(child);
+    }
+  }
+  kfree(progname);
+  if (result) {
+    spawn_args_destroy(sa);
+    return result;
+  }
+  child->exit_code = -1;
+
+  result = spawn_files(child, ufds, nfds);
+  if (result) {
+    proc_destroy(child);
+    spawn_args_destroy(sa);
+    return result;
+  }
+
+  /* Link it in before it can run, in case it exits right away. */
+  lock_acquire(proctree_lock);
+  proc_addchild(curproc, child);
+  lock_release(proctree_lock);
+
+  /* As in fork, the child may be gone once it starts. */
+  pid = child->pid;
+
+  result = thread_fork(curthread->t_name, child, spawn_start, sa, 0);
+  if (result) {
+    lock_acquire(proctree_lock);
+    proc_unlink(child);
+    lock_release(proctree_lock);
+    proc_destroy(child);
+    spawn_args_destroy(sa);
+    return result;
+  }
+
+  *retval = pid;
+  return 0;
+}
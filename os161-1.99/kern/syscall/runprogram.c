@@ -45,6 +45,7 @@
 #include <syscall.h>
 #include <test.h>
 #include <copyinout.h>
+#include <file.h>
 
 /*
  * Load program "progname" and start running it in usermode.
@@ -60,6 +61,19 @@ runprogram(char *progname, int args_many, char **args)
 	vaddr_t entrypoint, stackptr;
 	int result;
 
+	/* Set up stdin, stdout and stderr. */
+	if (curproc->p_files == NULL) {
+		curproc->p_files = filetable_create();
+		if (curproc->p_files == NULL) {
+			return ENOMEM;
+		}
+		result = filetable_openstdio(curproc->p_files);
+		if (result) {
+			/* p_files will go away when curproc is destroyed */
+			return result;
+		}
+	}
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * System call statistics. See <syscallstats.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/syscall.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <clock.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <syscallstats.h>
+
+/* The system-wide table, and its lock. */
+static struct syscallstat syscallstats_all[SCS_NCALLS];
+static struct spinlock syscallstats_lock = SPINLOCK_INITIALIZER;
+
+/* Names of the calls syscall() knows about, for printing. */
+static const char *const syscallstats_names[SCS_NCALLS] = {
+	[SYS_fork] = "fork",
+	[SYS_execv] = "execv",
+	[SYS__exit] = "_exit",
+	[SYS_waitpid] = "waitpid",
+	[SYS_getpid] = "getpid",
+	[SYS_open] = "open",
+	[SYS_pipe] = "pipe",
+	[SYS_dup2] = "dup2",
+	[SYS_fcntl] = "fcntl",
+	[SYS_close] = "close",
+	[SYS_read] = "read",
+	[SYS_pread] = "pread",
+	[SYS_readv] = "readv",
+	[SYS_write] = "write",
+	[SYS_pwrite] = "pwrite",
+	[SYS_writev] = "writev",
+	[SYS_lseek] = "lseek",
+	[SYS___time] = "__time",
+	[SYS_nanosleep] = "nanosleep",
+	[SYS_reboot] = "reboot",
+	[SYS_futex_wait] = "futex_wait",
+	[SYS_futex_wake] = "futex_wake",
+	[SYS_copy_file_range] = "copy_file_range",
+	[SYS_spawn] = "spawn",
+	[SYS___thread_create] = "__thread_create",
+	[SYS_thread_exit] = "thread_exit",
+	[SYS_syscallstats] = "syscallstats",
+};
+
+void
+syscallstats_proc_init(struct syscallstats_proc *sp)
+{
+	bzero(sp, sizeof(*sp));
+}
+
+/*
+ * Which bucket a latency of SECS/NSECS goes in.
+ */
+static
+unsigned
+syscallstats_bucket(time_t secs, uint32_t nsecs)
+{
+	uint32_t usecs;
+	unsigned b;
+
+	/*
+	 * The last bucket starts at 2^(SCS_NBUCKETS-2) usecs, a bit
+	 * over 4 seconds; stopping at 5 keeps usecs in 32 bits.
+	 */
+	if (secs >= 5) {
+		return SCS_NBUCKETS - 1;
+	}
+	usecs = (uint32_t)secs * 1000000 + nsecs / 1000;
+	for (b = 0; usecs != 0 && b < SCS_NBUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	return b;
+}
+
+void
+syscallstats_record(int callno, time_t startsecs, uint32_t startnsecs,
+		    int err)
+{
+	struct proc *p = curproc;
+	struct syscallstat *ss;
+	time_t secs;
+	uint32_t nsecs;
+	unsigned b;
+
+	if (callno < 0 || callno >= SCS_NCALLS) {
+		return;
+	}
+
+	gettime(&secs, &nsecs);
+	getinterval(startsecs, startnsecs, secs, nsecs, &secs, &nsecs);
+	b = syscallstats_bucket(secs, nsecs);
+
+	spinlock_acquire(&syscallstats_lock);
+	ss = &syscallstats_all[callno];
+	ss->ss_calls++;
+	if (err) {
+		ss->ss_errors++;
+	}
+	ss->ss_hist[b]++;
+	spinlock_release(&syscallstats_lock);
+
+	spinlock_acquire(&p->p_lock);
+	p->p_sysstats.sp_calls[callno]++;
+	if (err) {
+		p->p_sysstats.sp_errors[callno]++;
+	}
+	p->p_sysstats.sp_hist[b]++;
+	spinlock_release(&p->p_lock);
+}
+
+/*
+ * Add up the counts of calls FIRST..LAST-1 into RET.
+ */
+static
+void
+syscallstats_sum(const struct syscallstat *table, int first, int last,
+		 struct syscallstat *ret)
+{
+	int i;
+	unsigned b;
+
+	for (i=first; i<last; i++) {
+		ret->ss_calls += table[i].ss_calls;
+		ret->ss_errors += table[i].ss_errors;
+		for (b=0; b<SCS_NBUCKETS; b++) {
+			ret->ss_hist[b] += table[i].ss_hist[b];
+		}
+	}
+}
+
+int
+syscallstats_get(pid_t pid, int callno, struct syscallstat *ret)
+{
+	struct syscallstats_proc *sp;
+	struct proc *p;
+	int first, last, i, result;
+
+	if (callno < -1 || callno >= SCS_NCALLS) {
+		return EINVAL;
+	}
+	first = callno < 0 ? 0 : callno;
+	last = callno < 0 ? SCS_NCALLS : callno + 1;
+
+	bzero(ret, sizeof(*ret));
+
+	if (pid == 0) {
+		spinlock_acquire(&syscallstats_lock);
+		syscallstats_sum(syscallstats_all, first, last, ret);
+		spinlock_release(&syscallstats_lock);
+		return 0;
+	}
+
+	/* The tree lock keeps the process from going away under us. */
+	lock_acquire(proctree_lock);
+	p = proc_lookup(pid);
+	if (p == NULL) {
+		result = ESRCH;
+	}
+	else if (p != curproc && p->parent != curproc) {
+		result = EPERM;
+	}
+	else {
+		sp = &p->p_sysstats;
+		spinlock_acquire(&p->p_lock);
+		for (i=first; i<last; i++) {
+			ret->ss_calls += sp->sp_calls[i];
+			ret->ss_errors += sp->sp_errors[i];
+		}
+		if (callno < 0) {
+			memcpy(ret->ss_hist, sp->sp_hist, sizeof(ret->ss_hist));
+		}
+		spinlock_release(&p->p_lock);
+		result = 0;
+	}
+	lock_release(proctree_lock);
+	return result;
+}
+
+int
+sys_syscallstats(pid_t pid, int callno, userptr_t buf)
+{
+	struct syscallstat ss;
+	int result;
+
+	result = syscallstats_get(pid, callno, &ss);
+	if (result) {
+		return result;
+	}
+	return copyout(&ss, buf, sizeof(ss));
+}
+
+int
+syscallstats_lookup(const char *name)
+{
+	int i;
+
+	for (i=0; i<SCS_NCALLS; i++) {
+		if (syscallstats_names[i] != NULL &&
+		    !strcmp(syscallstats_names[i], name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Format the upper bound of bucket B, in microseconds, into BUF.
+ */
+static
+void
+syscallstats_bound(unsigned b, char *buf, size_t len)
+{
+	if (b == SCS_NBUCKETS - 1) {
+		snprintf(buf, len, ">=%u", 1U << (b - 1));
+	}
+	else {
+		snprintf(buf, len, "<%u", 1U << b);
+	}
+}
+
+/*
+ * The bucket the PCTth percentile latency of SS falls in.
+ */
+static
+unsigned
+syscallstats_pct(const struct syscallstat *ss, unsigned pct)
+{
+	uint32_t want, seen;
+	unsigned b;
+
+	/* Round up, so the 99th percentile of a few calls is the top. */
+	want = ((uint64_t)ss->ss_calls * pct + 99) / 100;
+	seen = 0;
+	for (b=0; b<SCS_NBUCKETS - 1; b++) {
+		seen += ss->ss_hist[b];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return b;
+}
+
+static
+void
+syscallstats_name(int callno, char *buf, size_t len)
+{
+	if (syscallstats_names[callno] != NULL) {
+		snprintf(buf, len, "%s", syscallstats_names[callno]);
+	}
+	else {
+		snprintf(buf, len, "#%d", callno);
+	}
+}
+
+void
+syscallstats_print(void)
+{
+	struct syscallstat ss;
+	char name[16], p50[12], p99[12], max[12];
+	unsigned b;
+	int i;
+
+	kprintf("%-15s %9s %8s %9s %9s %9s\n", "call", "calls", "errors",
+		"p50", "p99", "max");
+	for (i=0; i<SCS_NCALLS; i++) {
+		/* One at a time; the whole table is too big for the stack. */
+		spinlock_acquire(&syscallstats_lock);
+		ss = syscallstats_all[i];
+		spinlock_release(&syscallstats_lock);
+
+		if (ss.ss_calls == 0) {
+			continue;
+		}
+		b = SCS_NBUCKETS - 1;
+		while (b > 0 && ss.ss_hist[b] == 0) {
+			b--;
+		}
+		syscallstats_name(i, name, sizeof(name));
+		syscallstats_bound(syscallstats_pct(&ss, 50), p50, sizeof(p50));
+		syscallstats_bound(syscallstats_pct(&ss, 99), p99, sizeof(p99));
+		syscallstats_bound(b, max, sizeof(max));
+		kprintf("%-15s %9u %8u %9s %9s %9s\n", name, ss.ss_calls,
+			ss.ss_errors, p50, p99, max);
+	}
+	kprintf("(latencies in microseconds)\n");
+}
+
+void
+syscallstats_printcall(int callno)
+{
+	struct syscallstat ss;
+	char name[16], bound[12];
+	unsigned b;
+
+	KASSERT(callno >= 0 && callno < SCS_NCALLS);
+
+	spinlock_acquire(&syscallstats_lock);
+	ss = syscallstats_all[callno];
+	spinlock_release(&syscallstats_lock);
+
+	syscallstats_name(callno, name, sizeof(name));
+	kprintf("%s: %u calls, %u errors\n", name, ss.ss_calls,
+		ss.ss_errors);
+	for (b=0; b<SCS_NBUCKETS; b++) {
+		if (ss.ss_hist[b] == 0) {
+			continue;
+		}
+		syscallstats_bound(b, bound, sizeof(bound));
+		kprintf("%12s us: %u\n", bound, ss.ss_hist[b]);
+	}
+}
+
+void
+syscallstats_reset(void)
+{
+	spinlock_acquire(&syscallstats_lock);
+	bzero(syscallstats_all, sizeof(syscallstats_all));
+	spinlock_release(&syscallstats_lock);
+}
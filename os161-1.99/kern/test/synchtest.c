@@ -32,9 +32,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -347,3 +350,458 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test.
+ *
+ * Most iterations read the test values and check that they are
+ * consistent, dawdling a little so readers overlap; some write them,
+ * and some read and then upgrade to write and downgrade again. The
+ * number of readers seen inside the lock at once shows whether reads
+ * actually run in parallel; with more than one cpu, it had better be
+ * at least two.
+ */
+#define NRWLOOPS      200
+
+static struct rwlock *testrwlock;
+static struct spinlock rwstat_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rw_nreaders, rw_maxreaders, rw_upgrades;
+static volatile bool rw_failed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	rw_failed = true;
+}
+
+static
+void
+rwcheck(unsigned long num)
+{
+	if (testval2 != testval1*testval1) {
+		rwfail(num, "testval2/testval1");
+	}
+	if (testval3 != testval1%3) {
+		rwfail(num, "testval3/testval1");
+	}
+}
+
+static
+void
+rwwrite(unsigned long num)
+{
+	if (rw_nreaders != 0) {
+		rwfail(num, "readers inside write lock");
+	}
+	testval1 = num;
+	testval2 = num*num;
+	testval3 = num%3;
+	thread_yield();
+	if (testval1 != num || testval2 != num*num || testval3 != num%3) {
+		rwfail(num, "testvals changed under write lock");
+	}
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		switch ((i + num) % 16) {
+		    case 0:
+			rwlock_acquire_write(testrwlock);
+			rwwrite(num);
+			rwlock_release_write(testrwlock);
+			break;
+		    case 8:
+			rwlock_acquire_read(testrwlock);
+			rwcheck(num);
+			if (rwlock_upgrade(testrwlock) == 0) {
+				rwwrite(num);
+				rwlock_downgrade(testrwlock);
+				if (testval1 != num) {
+					rwfail(num, "testval1 after downgrade");
+				}
+				spinlock_acquire(&rwstat_lock);
+				rw_upgrades++;
+				spinlock_release(&rwstat_lock);
+			}
+			rwlock_release_read(testrwlock);
+			break;
+		    default:
+			rwlock_acquire_read(testrwlock);
+			spinlock_acquire(&rwstat_lock);
+			rw_nreaders++;
+			if (rw_nreaders > rw_maxreaders) {
+				rw_maxreaders = rw_nreaders;
+			}
+			spinlock_release(&rwstat_lock);
+
+			rwcheck(num);
+			for (j=0; j<500; j++);
+			rwcheck(num);
+
+			spinlock_acquire(&rwstat_lock);
+			rw_nreaders--;
+			spinlock_release(&rwstat_lock);
+			rwlock_release_read(testrwlock);
+			break;
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+rwlocktest(int nargs, char **args)
+{
+	int i, result;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrwlock = rwlock_create("testrwlock");
+	if (testrwlock == NULL) {
+		panic("rwlocktest: rwlock_create failed\n");
+	}
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = testval3 = 0;
+	rw_nreaders = rw_maxreaders = rw_upgrades = 0;
+	rw_failed = false;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+
+	kprintf("%u readers at once at most, %u upgrades, %lu.%09lu seconds\n",
+		rw_maxreaders, rw_upgrades,
+		(unsigned long)secs, (unsigned long)nsecs);
+	if (cpu_count() > 1 && rw_maxreaders < 2) {
+		kprintf("Readers never overlapped on %u cpus\n", cpu_count());
+		rw_failed = true;
+	}
+
+	rwlock_destroy(testrwlock);
+	testrwlock = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf(rw_failed ? "Test failed\n" : "Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Spinlock microbenchmark.
+ *
+ * 1, 2, 4 and 8 threads hammer on one spinlock and we report how many
+ * acquires per second get through. Configure at least as many CPUs as
+ * threads to see contention; otherwise this mostly measures the
+ * uncontended path.
+ */
+#define NSLBENCHLOOPS      10000
+#define SLBENCH_MAXTHREADS 8
+
+static struct spinlock slbench_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned long slbench_count;
+
+static
+void
+slbenchthread(void *junk, unsigned long loops)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<loops; i++) {
+		spinlock_acquire(&slbench_lock);
+		slbench_count++;
+		spinlock_release(&slbench_lock);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	int i, nthreads, loops, result;
+	time_t secs1, secs2, secs;
+	uint32_t nsecs1, nsecs2, nsecs;
+	uint64_t ns;
+
+	loops = NSLBENCHLOOPS;
+	if (nargs > 1) {
+		loops = atoi(args[1]);
+	}
+	if (nargs > 2 || loops <= 0) {
+		kprintf("Usage: sy5 [loops]\n");
+		return EINVAL;
+	}
+
+	inititems();
+	kprintf("Starting spinlock benchmark...\n");
+
+	for (nthreads = 1; nthreads <= SLBENCH_MAXTHREADS; nthreads *= 2) {
+		slbench_count = 0;
+		gettime(&secs1, &nsecs1);
+		for (i=0; i<nthreads; i++) {
+			result = thread_fork("slbench", NULL, slbenchthread,
+					     NULL, loops);
+			if (result) {
+				panic("spinlockbench: thread_fork failed: "
+				      "%s\n", strerror(result));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(donesem);
+		}
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs, &nsecs);
+
+		if (slbench_count != (unsigned long)nthreads * loops) {
+			kprintf("Count is %lu, should be %lu\n",
+				slbench_count,
+				(unsigned long)nthreads * loops);
+			kprintf("Test failed\n");
+		}
+		ns = (uint64_t)secs * 1000000000 + nsecs;
+		kprintf("%d thread%s: %lu acquires in %lu.%09lu seconds, "
+			"%lu per second\n",
+			nthreads, nthreads == 1 ? "" : "s", slbench_count,
+			(unsigned long)secs, (unsigned long)nsecs,
+			ns == 0 ? 0 : (unsigned long)
+			((uint64_t)slbench_count * 1000000000 / ns));
+	}
+
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("Spinlock benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Priority inheritance test.
+ *
+ * We drop to the bottom level and take lock A. A second thread (also
+ * at the bottom) takes lock B and then waits for A; a third, at the
+ * top level, waits for B. Each waiter should lend its level down the
+ * chain to us. Then a CPU-bound thread starts spinning at a middle
+ * level while we hold on to A a little longer. Without inheritance
+ * it would keep us (and so the top thread) off the cpu until it gave
+ * up, so the top thread's wait must stay under PI_MAXWAIT ticks. Once
+ * the locks are released everyone should be back to their own level.
+ *
+ * Priority boosts would rescue us even without inheritance, so they
+ * are turned off for the duration.
+ */
+#define PI_SPINLEVEL	1			/* the CPU-bound thread's level */
+#define PI_MAXWAIT	10			/* ticks the top thread may wait */
+#define PI_SPINTICKS	(PI_MAXWAIT * 5)	/* when the spinner gives up */
+#define PI_YIELDS	10			/* yields while still holding A */
+
+static struct lock *pi_locka, *pi_lockb;
+static struct thread *volatile pi_mid, *volatile pi_high;
+static volatile bool pi_failed, pi_done;
+
+static
+void
+picheck(const char *who, int got, int want)
+{
+	if (got != want) {
+		kprintf("%s: inherited level %d, should be %d\n",
+			who, got, want);
+		pi_failed = true;
+	}
+}
+
+static
+void
+pimidthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pi_mid = curthread;
+	lock_acquire(pi_lockb);
+	V(testsem);
+	lock_acquire(pi_locka);
+
+	/* The high thread is still waiting for B. */
+	lock_release(pi_locka);
+	picheck("mid thread holding B", curthread->t_inherited,
+		thread_effpriority(pi_high));
+	lock_release(pi_lockb);
+	picheck("mid thread after release", curthread->t_inherited,
+		SCHED_NLEVELS);
+
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pihighthread(void *junk, unsigned long num)
+{
+	unsigned start, waited;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(0);
+	pi_high = curthread;
+	start = timer_getticks();
+	lock_acquire(pi_lockb);
+	lock_release(pi_lockb);
+	waited = timer_getticks() - start;
+	pi_done = true;
+
+	kprintf("High thread waited %u ticks\n", waited);
+	if (waited > PI_MAXWAIT) {
+		kprintf("High thread: waited more than %d ticks\n",
+			PI_MAXWAIT);
+		pi_failed = true;
+	}
+
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+/*
+ * Compete for the cpu from the middle level, staying there rather
+ * than sinking, until the high thread is through or we've spun long
+ * enough to show there's no inheritance.
+ */
+static
+void
+pispinthread(void *junk, unsigned long num)
+{
+	unsigned start;
+
+	(void)junk;
+	(void)num;
+
+	start = timer_getticks();
+	while (!pi_done && timer_getticks() - start < PI_SPINTICKS) {
+		thread_setpriority(PI_SPINLEVEL);
+	}
+
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned boost;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	pi_locka = lock_create("pi_locka");
+	pi_lockb = lock_create("pi_lockb");
+	if (pi_locka == NULL || pi_lockb == NULL) {
+		panic("pitest: lock_create failed\n");
+	}
+	pi_mid = pi_high = NULL;
+	pi_failed = pi_done = false;
+	kprintf("Starting priority inheritance test...\n");
+
+	boost = thread_getquantum(SCHED_NLEVELS);
+	thread_setquantum(SCHED_NLEVELS, (unsigned)-1);
+	thread_setpriority(SCHED_NLEVELS - 1);
+
+	lock_acquire(pi_locka);
+
+	result = thread_fork("pimid", NULL, pimidthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(testsem);
+	while (pi_mid->t_blockedon != pi_locka) {
+		thread_yield();
+	}
+	picheck("main thread, one waiter", curthread->t_inherited,
+		thread_effpriority(pi_mid));
+
+	result = thread_fork("pihigh", NULL, pihighthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (pi_high == NULL || pi_high->t_blockedon != pi_lockb) {
+		thread_yield();
+	}
+	picheck("mid thread", pi_mid->t_inherited,
+		thread_effpriority(pi_high));
+	if (curthread->t_inherited > thread_effpriority(pi_high)) {
+		kprintf("main thread: inherited level %d, should be at "
+			"most %d\n", curthread->t_inherited,
+			thread_effpriority(pi_high));
+		pi_failed = true;
+	}
+
+	result = thread_fork("pispin", NULL, pispinthread, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	for (i=0; i<PI_YIELDS; i++) {
+		thread_yield();
+	}
+
+	lock_release(pi_locka);
+	picheck("main thread after release", curthread->t_inherited,
+		SCHED_NLEVELS);
+
+	P(donesem);
+	P(donesem);
+	P(donesem);
+	thread_setquantum(SCHED_NLEVELS, boost);
+	thread_setpriority(0);
+
+	lock_destroy(pi_locka);
+	lock_destroy(pi_lockb);
+	pi_locka = pi_lockb = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf(pi_failed ? "Test failed\n" :
+		"Priority inheritance test done.\n");
+
+	return 0;
+}
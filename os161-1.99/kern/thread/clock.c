@@ -28,20 +28,23 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
+#include <mainbus.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * timerclock() drives a tick counter and a timer wheel for scheduling
+ * callbacks at specific points in the future, with a resolution of
+ * one timer tick.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -55,23 +58,194 @@
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * The timer wheel.
+ *
+ * Pending timeouts hang off TW_LEVELS levels of TW_SIZE slots each.
+ * A timeout due within TW_SIZE ticks goes in level 0, in the slot for
+ * its expiry tick; one due within TW_SIZE^2 ticks goes in level 1, in
+ * the slot for its expiry tick divided by TW_SIZE; and so on. Each
+ * tick fires everything in the current level 0 slot. Every TW_SIZE
+ * ticks the next level 1 slot is cascaded, that is, its timeouts are
+ * reinserted, which spreads them across level 0; level 1 is refilled
+ * from level 2 the same way, and so on up.
+ *
+ * Timeouts further out than the top level can reach are parked in
+ * the top level's furthest slot and simply cascade again.
+ *
+ * The slot lists are circular, with a dummy struct timeout as head.
  */
-static struct wchan *lbolt;
+#define TW_BITS		6
+#define TW_SIZE		(1 << TW_BITS)
+#define TW_MASK		(TW_SIZE - 1)
+#define TW_LEVELS	4
+
+/* Timeout states */
+#define TO_IDLE		0	/* not armed */
+#define TO_PENDING	1	/* on the wheel */
+#define TO_FIRING	2	/* expired; function about to be or being called */
+
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+static struct timeout timer_wheel[TW_LEVELS][TW_SIZE];
+static volatile unsigned timer_ticks;
+
+/* Used by clocksleep and friends. */
+static struct wchan *clock_wchan;
+
+static
+void
+timeout_listinit(struct timeout *head)
+{
+	head->to_next = head;
+	head->to_prev = head;
+}
+
+static
+bool
+timeout_listempty(struct timeout *head)
+{
+	return head->to_next == head;
+}
+
+static
+void
+timeout_unlink(struct timeout *to)
+{
+	to->to_prev->to_next = to->to_next;
+	to->to_next->to_prev = to->to_prev;
+	to->to_next = to->to_prev = NULL;
+}
+
+static
+void
+timeout_append(struct timeout *head, struct timeout *to)
+{
+	to->to_prev = head->to_prev;
+	to->to_next = head;
+	head->to_prev->to_next = to;
+	head->to_prev = to;
+}
+
 /*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * Put TO in the right slot for its expiry time. Timer lock must be
+ * held.
  */
-static struct wchan *minibolt;
+static
+void
+timeout_insert(struct timeout *to)
+{
+	unsigned delta, expires, level;
+
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+
+	expires = to->to_expires;
+	delta = expires - timer_ticks;
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < (1U << (TW_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	if (delta >= (1U << (TW_BITS * TW_LEVELS))) {
+		/* Too far out; park it as far out as we can see. */
+		expires = timer_ticks + (1U << (TW_BITS * TW_LEVELS)) - 1;
+	}
+	timeout_append(&timer_wheel[level][(expires >> (TW_BITS * level))
+					   & TW_MASK], to);
+}
 
-/* 
- * number of minibolts per second
+/*
+ * Reinsert everything in slot SLOT of level LEVEL. Timer lock must be
+ * held.
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static
+void
+timeout_cascade(unsigned level, unsigned slot)
+{
+	struct timeout list, *to;
+
+	timeout_listinit(&list);
+	while (!timeout_listempty(&timer_wheel[level][slot])) {
+		to = timer_wheel[level][slot].to_next;
+		timeout_unlink(to);
+		timeout_append(&list, to);
+	}
+	while (!timeout_listempty(&list)) {
+		to = list.to_next;
+		timeout_unlink(to);
+		timeout_insert(to);
+	}
+}
+
+void
+timeout_init(struct timeout *to, void (*func)(void *), void *arg)
+{
+	to->to_next = to->to_prev = NULL;
+	to->to_expires = 0;
+	to->to_state = TO_IDLE;
+	to->to_func = func;
+	to->to_arg = arg;
+}
 
 /*
- * minibolt countdown
+ * Arm TO to fire TICKS timer ticks from now. A timeout for zero ticks
+ * fires on the next tick.
  */
-static int minicount;
+void
+timeout_add(struct timeout *to, unsigned ticks)
+{
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(to->to_state == TO_IDLE);
+	to->to_expires = timer_ticks + ticks;
+	to->to_state = TO_PENDING;
+	timeout_insert(to);
+	spinlock_release(&timer_lock);
+}
+
+bool
+timeout_cancel(struct timeout *to)
+{
+	bool ret;
+
+	spinlock_acquire(&timer_lock);
+	while (to->to_state == TO_FIRING) {
+		/* Let timerclock finish calling it. */
+		spinlock_release(&timer_lock);
+		spinlock_acquire(&timer_lock);
+	}
+	if (to->to_state == TO_PENDING) {
+		timeout_unlink(to);
+		to->to_state = TO_IDLE;
+		ret = true;
+	}
+	else {
+		ret = false;
+	}
+	spinlock_release(&timer_lock);
+	return ret;
+}
+
+unsigned
+timer_getticks(void)
+{
+	return timer_ticks;
+}
+
+unsigned
+timer_nstoticks(uint64_t nsecs)
+{
+	const uint64_t nspertick = 1000000000ULL / TIMER_HZ;
+	uint64_t ticks;
+
+	ticks = (nsecs + nspertick - 1) / nspertick;
+	if (ticks > 0x7fffffff) {
+		/* About eight months; close enough to forever. */
+		ticks = 0x7fffffff;
+	}
+	return ticks;
+}
 
 /*
  * Setup.
@@ -79,38 +253,78 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	unsigned i, j;
+
+	/* we assume the timer hardware ticks at the rate we think it does */
+	KASSERT(TIMER_HZ == 1000000 / LT_GRANULARITY);
+
+	for (i=0; i<TW_LEVELS; i++) {
+		for (j=0; j<TW_SIZE; j++) {
+			timeout_listinit(&timer_wheel[i][j]);
+		}
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	timer_ticks = 0;
+
+	clock_wchan = wchan_create("clocksleep");
+	if (clock_wchan == NULL) {
+		panic("Couldn't create clocksleep wchan\n");
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
 }
 
 /*
  * This is called once every every LT_GRANULARITY usec, on one processor,
- * by the timer code.
+ * by the timer code. It advances the clock and fires whatever timeouts
+ * are due; no other work is done per tick.
  */
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct timeout expired, *to, *head;
+	unsigned level;
+
+	timeout_listinit(&expired);
+
+	spinlock_acquire(&timer_lock);
+	timer_ticks++;
+
+	/* Cascade each level whose lower level just wrapped around. */
+	for (level = 1; level < TW_LEVELS; level++) {
+		if (((timer_ticks >> (TW_BITS * (level - 1))) & TW_MASK) != 0) {
+			break;
+		}
+		timeout_cascade(level,
+				(timer_ticks >> (TW_BITS * level)) & TW_MASK);
+	}
+
+	head = &timer_wheel[0][timer_ticks & TW_MASK];
+	while (!timeout_listempty(head)) {
+		to = head->to_next;
+		timeout_unlink(to);
+		KASSERT(to->to_expires == timer_ticks);
+		to->to_state = TO_FIRING;
+		timeout_append(&expired, to);
+	}
+
+	/*
+	 * Call the functions without the timer lock, so they can take
+	 * wait channel locks that are held while timeouts are armed.
+	 * Each stays TO_FIRING, which keeps timeout_cancel from
+	 * returning, until its function is done.
+	 */
+	while (!timeout_listempty(&expired)) {
+		to = expired.to_next;
+		timeout_unlink(to);
+		spinlock_release(&timer_lock);
+		to->to_func(to->to_arg);
+		spinlock_acquire(&timer_lock);
+		to->to_state = TO_IDLE;
 	}
+	spinlock_release(&timer_lock);
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * This is called HZ times a second (on each processor that isn't
+ * idle) by the timer code.
  */
 void
 hardclock(void)
@@ -120,13 +334,36 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_isidle) {
+		/*
+		 * We interrupted the idle loop. There's nothing to
+		 * schedule or migrate; make sure the tick stays off.
+		 */
+		mainbus_hardclock_stop();
+		return;
+	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_timeslice();
+}
+
+/*
+ * Sleep on the clock wait channel for TICKS timer ticks.
+ */
+static
+void
+clocksleep_ticks(unsigned ticks)
+{
+	int result;
+
+	wchan_lock(clock_wchan);
+	result = wchan_timedsleep(clock_wchan, ticks);
+	/* Nobody else wakes the clock channel. */
+	KASSERT(result == ETIMEDOUT);
 }
 
 /*
@@ -135,23 +372,30 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		clocksleep_ticks(num_secs * TIMER_HZ);
+	}
 }
 
 /*
  * Suspend execution for num_ticks timer ticks.
- *  (one tick every LT_GRANULARITY usec)
  */
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks > 0) {
+		clocksleep_ticks(num_ticks);
+	}
+}
+
+/*
+ * Suspend execution for at least nsecs nanoseconds. The current tick
+ * is already partly over, so wait one more than the duration needs.
+ */
+void
+clocksleep_ns(uint64_t nsecs)
+{
+	if (nsecs > 0) {
+		clocksleep_ticks(timer_nstoticks(nsecs) + 1);
+	}
 }
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock contention statistics. See <lockstat.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <lockstat.h>
+
+struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+
+/* All registered locks. Dummy head; circular. */
+static struct lockstat lockstat_all = {
+	.ls_next = &lockstat_all,
+	.ls_prev = &lockstat_all,
+};
+
+void
+lockstat_init(struct lockstat *ls, const void *obj)
+{
+	bzero(ls, sizeof(*ls));
+	ls->ls_obj = obj;
+}
+
+void
+lockstat_register(struct lockstat *ls, const char *kind, const char *name)
+{
+	spinlock_acquire(&lockstat_lock);
+	KASSERT(ls->ls_kind == NULL);
+	ls->ls_kind = kind;
+	ls->ls_name = name;
+	ls->ls_prev = lockstat_all.ls_prev;
+	ls->ls_next = &lockstat_all;
+	lockstat_all.ls_prev->ls_next = ls;
+	lockstat_all.ls_prev = ls;
+	spinlock_release(&lockstat_lock);
+}
+
+void
+lockstat_unregister(struct lockstat *ls)
+{
+	/* Unlocked peek: only the lock's owner registers it. */
+	if (ls->ls_kind == NULL) {
+		return;
+	}
+	spinlock_acquire(&lockstat_lock);
+	ls->ls_prev->ls_next = ls->ls_next;
+	ls->ls_next->ls_prev = ls->ls_prev;
+	ls->ls_next = ls->ls_prev = NULL;
+	ls->ls_kind = NULL;
+	spinlock_release(&lockstat_lock);
+}
+
+/*
+ * The counters of each lock are protected by the lock itself, so
+ * these need no locking of their own.
+ */
+void
+lockstat_acquired(struct lockstat *ls, unsigned start, bool contended)
+{
+	unsigned now, wait;
+
+	now = timer_getticks();
+	ls->ls_acquires++;
+	if (contended) {
+		wait = now - start;
+		ls->ls_contended++;
+		ls->ls_waitticks += wait;
+		if (wait > ls->ls_maxwait) {
+			ls->ls_maxwait = wait;
+		}
+	}
+	ls->ls_heldsince = now;
+}
+
+void
+lockstat_released(struct lockstat *ls)
+{
+	ls->ls_holdticks += timer_getticks() - ls->ls_heldsince;
+}
+
+void
+lockstat_spinacquired(struct lockstat *ls, const void *obj, unsigned start,
+		      bool contended)
+{
+	lockstat_acquired(ls, start, contended);
+	if (contended && ls->ls_kind == NULL) {
+		ls->ls_obj = obj;
+		lockstat_register(ls, "spinlock", NULL);
+	}
+}
+
+/*
+ * Snapshot for lockstat_print. Static because it's too big for the
+ * stack of the menu thread; only the menu calls lockstat_print, so
+ * there's never more than one user.
+ */
+static struct lockstat lockstat_top[LOCKSTAT_MAXPRINT];
+static char lockstat_names[LOCKSTAT_MAXPRINT][24];
+
+void
+lockstat_print(unsigned num)
+{
+	struct lockstat *top = lockstat_top, *ls;
+	char (*names)[24] = lockstat_names;
+	unsigned ntop, i, j;
+
+	if (num > LOCKSTAT_MAXPRINT) {
+		num = LOCKSTAT_MAXPRINT;
+	}
+
+	/*
+	 * Collect the top entries (insertion sort into top[]) with
+	 * the lock held, then print them without it, since kprintf
+	 * can sleep. Copy the names, since the locks may be destroyed
+	 * once we let go.
+	 */
+	ntop = 0;
+	spinlock_acquire(&lockstat_lock);
+	for (ls = lockstat_all.ls_next; ls != &lockstat_all; ls = ls->ls_next) {
+		if (ls->ls_contended == 0) {
+			continue;
+		}
+		for (j = ntop; j > 0; j--) {
+			if (top[j-1].ls_contended >= ls->ls_contended) {
+				break;
+			}
+			if (j < num) {
+				top[j] = top[j-1];
+				memcpy(names[j], names[j-1], sizeof(names[j]));
+			}
+		}
+		if (j < num) {
+			top[j] = *ls;
+			if (ls->ls_name != NULL) {
+				size_t len = strlen(ls->ls_name);
+
+				if (len >= sizeof(names[j])) {
+					len = sizeof(names[j]) - 1;
+				}
+				memcpy(names[j], ls->ls_name, len);
+				names[j][len] = 0;
+			}
+			else {
+				snprintf(names[j], sizeof(names[j]), "%p",
+					 ls->ls_obj);
+			}
+			if (ntop < num) {
+				ntop++;
+			}
+		}
+	}
+	spinlock_release(&lockstat_lock);
+
+	kprintf("%-8s %-23s %9s %9s %8s %6s %8s\n", "kind", "name",
+		"acquires", "contended", "wait", "max", "held");
+	for (i=0; i<ntop; i++) {
+		kprintf("%-8s %-23s %9u %9u %8u %6u %8u\n",
+			top[i].ls_kind, names[i], top[i].ls_acquires,
+			top[i].ls_contended, top[i].ls_waitticks,
+			top[i].ls_maxwait, top[i].ls_holdticks);
+	}
+	kprintf("(times in ticks of 1/%d second)\n", TIMER_HZ);
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+
+	spinlock_acquire(&lockstat_lock);
+	for (ls = lockstat_all.ls_next; ls != &lockstat_all; ls = ls->ls_next) {
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitticks = 0;
+		ls->ls_maxwait = 0;
+		ls->ls_holdticks = 0;
+	}
+	spinlock_release(&lockstat_lock);
+}
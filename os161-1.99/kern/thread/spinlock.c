@@ -36,11 +36,25 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <clock.h>	/* for timer_getticks */
 
 /*
  * Spinlocks.
  */
 
+/*
+ * Backoff, in loop iterations per waiter ahead of us. Each of them
+ * will hold the lock for a while, so there's no point looking again
+ * sooner; and looking less often keeps the lock's cache line quiet
+ * for the holder.
+ */
+#define SPINLOCK_BACKOFF 16
+
+#if OPT_LOCKSTAT
+/* The registry's own lock can't be profiled: we'd recurse on it. */
+#define SPINLOCK_PROFILED(lk) ((lk) != &lockstat_lock)
+#endif
+
 
 /*
  * Initialize spinlock.
@@ -48,8 +62,12 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&lk->lk_stat, lk);
+#endif
 }
 
 /*
@@ -59,7 +77,11 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
+#if OPT_LOCKSTAT
+	lockstat_unregister(&lk->lk_stat);
+#endif
 }
 
 /*
@@ -67,12 +89,18 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket and wait for our turn.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, ahead;
+	volatile unsigned i;
+#if OPT_LOCKSTAT
+	unsigned start = 0;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +115,30 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+	/*
+	 * Fetch-and-add is a machine-level atomic operation, so every
+	 * CPU gets a different ticket. Unsigned arithmetic makes the
+	 * distance come out right even when the counters wrap.
+	 */
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+	while ((ahead = ticket - spinlock_data_get(&lk->lk_serving)) != 0) {
+#if OPT_LOCKSTAT
+		if (!contended) {
+			start = timer_getticks();
+			contended = true;
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+#endif
+		for (i=0; i<ahead * SPINLOCK_BACKOFF; i++) {
+			/* nothing */
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	if (SPINLOCK_PROFILED(lk)) {
+		lockstat_spinacquired(&lk->lk_stat, lk, start, contended);
+	}
+#endif
 }
 
 /*
@@ -121,8 +152,16 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	if (SPINLOCK_PROFILED(lk)) {
+		lockstat_released(&lk->lk_stat);
+	}
+#endif
+
+	/* Only the holder writes lk_serving, so this needn't be atomic. */
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -33,12 +33,15 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
+#include <cpu.h>
 #include <current.h>
 #include <synch.h>
+#include <clock.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +74,10 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+#if OPT_LOCKSTAT
+        lockstat_init(&sem->sem_stat, sem);
+        lockstat_register(&sem->sem_stat, "sem", sem->sem_name);
+#endif
 
         return sem;
 }
@@ -81,6 +88,9 @@ sem_destroy(struct semaphore *sem)
         KASSERT(sem != NULL);
 
 	/* wchan_cleanup will assert if anyone's waiting on it */
+#if OPT_LOCKSTAT
+        lockstat_unregister(&sem->sem_stat);
+#endif
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
         kfree(sem->sem_name);
@@ -90,6 +100,11 @@ sem_destroy(struct semaphore *sem)
 void
 P(struct semaphore *sem)
 {
+#if OPT_LOCKSTAT
+        unsigned start = timer_getticks();
+        bool contended = false;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -118,6 +133,9 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
+#if OPT_LOCKSTAT
+		contended = true;
+#endif
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
                 wchan_sleep(sem->sem_wchan);
@@ -126,6 +144,9 @@ P(struct semaphore *sem)
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
+#if OPT_LOCKSTAT
+        lockstat_acquired(&sem->sem_stat, start, contended);
+#endif
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -149,9 +170,17 @@ V(struct semaphore *sem)
 
 struct lock *
 lock_create(const char *name)
+{
+        return lock_create_mode(name, LOCK_BARGE);
+}
+
+struct lock *
+lock_create_mode(const char *name, int mode)
 {
         struct lock *lock;
 
+        KASSERT(mode == LOCK_BARGE || mode == LOCK_HANDOFF);
+
         lock = kmalloc(sizeof(struct lock));
         if (lock == NULL) {
                 return NULL;
@@ -175,6 +204,17 @@ lock_create(const char *name)
         spinlock_init(&lock->lk_lock);
 
         lock->owner_thread = NULL;
+        lock->lk_mode = mode;
+        lock->lk_waiters = 0;
+        lock->lk_spins = 0;
+        lock->lk_blocks = 0;
+        lock->lk_piowner = NULL;
+        lock->lk_piwaiters = NULL;
+        lock->lk_heldnext = NULL;
+#if OPT_LOCKSTAT
+        lockstat_init(&lock->lk_stat, lock);
+        lockstat_register(&lock->lk_stat, "lock", lock->lk_name);
+#endif
 
         return lock;
 }
@@ -183,36 +223,285 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+        KASSERT(lock->lk_waiters == 0);
+        KASSERT(lock->lk_piowner == NULL);
 
         // add stuff here as needed
+#if OPT_LOCKSTAT
+        lockstat_unregister(&lock->lk_stat);
+#endif
         spinlock_cleanup(&lock->lk_lock);
         wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Adaptive spinning.
+ *
+ * OWNER may exit and be freed while we look at it, since we don't
+ * hold anything that stops it. That's harmless: the memory is still
+ * there to read, and once OWNER has released the lock, owner_thread
+ * no longer matches and we stop looking.
+ */
+#define LOCK_SPIN_MAX 1000
+
+static
+bool
+lock_owner_running(struct thread *owner)
+{
+        const volatile struct thread *t = owner;
+        const volatile struct cpu *c = t->t_cpu;
+
+        return t->t_state == S_RUN && c != NULL &&
+                c != curcpu->c_self && c->c_curthread == owner;
+}
+
+/* Spin until OWNER releases LOCK or stops running. */
+static
 void
-lock_acquire(struct lock *lock)
+lock_spin(struct lock *lock, struct thread *owner)
 {
-        // Write this
-        KASSERT(lock != NULL);
-        KASSERT(!lock_do_i_hold(lock));
-        KASSERT(curthread->t_in_interrupt == false);
+        unsigned i;
+
+        for (i=0; i<LOCK_SPIN_MAX; i++) {
+                if (lock->owner_thread != owner ||
+                    !lock_owner_running(owner)) {
+                        break;
+                }
+        }
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep for a lock puts itself on the lock's
+ * lk_piwaiters list and lends its level to the owner, and onward
+ * along the chain of owners if the owner is itself waiting. The lock
+ * goes on the owner's t_heldlocks list, so that when the owner lets go
+ * of it we can work out what the owner should still be inheriting from
+ * the other locks it holds. A thread that acquires a lock with waiters
+ * still listed takes over their loan.
+ *
+ * All of this is protected by pi_lock, which is taken with lk_lock
+ * held, and only when there's contention. Threads moved onto a lock by
+ * cv_broadcast don't lend anything until they've woken up once.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/* Best level among the threads waiting for LOCK. */
+static
+int
+pi_bestwaiter(struct lock *lock)
+{
+        struct thread *t;
+        int level, best = SCHED_NLEVELS;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        for (t = lock->lk_piwaiters; t != NULL; t = t->t_piwaitnext) {
+                level = thread_effpriority(t);
+                if (level < best) {
+                        best = level;
+                }
+        }
+        return best;
+}
+
+/* Start lending to OWNER, which we're about to sleep waiting for. */
+static
+void
+pi_block(struct lock *lock, struct thread *owner)
+{
+        struct thread *t;
+        int level;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        spinlock_acquire(&pi_lock);
+        curthread->t_blockedon = lock;
+        curthread->t_piwaitnext = lock->lk_piwaiters;
+        lock->lk_piwaiters = curthread;
+        if (lock->lk_piowner == NULL) {
+                lock->lk_piowner = owner;
+                lock->lk_heldnext = owner->t_heldlocks;
+                owner->t_heldlocks = lock;
+        }
+        KASSERT(lock->lk_piowner == owner);
+
+        /*
+         * Anything better than LEVEL that an owner down the chain
+         * could pass on, it already lent when it blocked.
+         */
+        level = thread_effpriority(curthread);
+        t = owner;
+        while (t != NULL && level < t->t_inherited) {
+                thread_setinherited(t, level);
+                t = t->t_blockedon != NULL ?
+                        t->t_blockedon->lk_piowner : NULL;
+        }
+        spinlock_release(&pi_lock);
+}
+
+/* Stop lending: we've woken up. */
+static
+void
+pi_unblock(struct lock *lock)
+{
+        struct thread **tp;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        spinlock_acquire(&pi_lock);
+        for (tp = &lock->lk_piwaiters; *tp != curthread;
+             tp = &(*tp)->t_piwaitnext) {
+                KASSERT(*tp != NULL);
+        }
+        *tp = curthread->t_piwaitnext;
+        curthread->t_piwaitnext = NULL;
+        curthread->t_blockedon = NULL;
+        spinlock_release(&pi_lock);
+}
+
+/* We got LOCK, and there are threads still waiting: take their loan. */
+static
+void
+pi_acquire(struct lock *lock)
+{
+        int level;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        spinlock_acquire(&pi_lock);
+        if (lock->lk_piowner != curthread) {
+                KASSERT(lock->lk_piowner == NULL);
+                lock->lk_piowner = curthread;
+                lock->lk_heldnext = curthread->t_heldlocks;
+                curthread->t_heldlocks = lock;
+        }
+        level = pi_bestwaiter(lock);
+        if (level < curthread->t_inherited) {
+                thread_setinherited(curthread, level);
+        }
+        spinlock_release(&pi_lock);
+}
+
+/* We're letting go of LOCK: stop inheriting through it. */
+static
+void
+pi_release(struct lock *lock)
+{
+        struct lock **lp, *l;
+        int level, best;
+
+        KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+        spinlock_acquire(&pi_lock);
+        for (lp = &curthread->t_heldlocks; *lp != lock;
+             lp = &(*lp)->lk_heldnext) {
+                KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_heldnext;
+        lock->lk_heldnext = NULL;
+        lock->lk_piowner = NULL;
+
+        best = SCHED_NLEVELS;
+        for (l = curthread->t_heldlocks; l != NULL; l = l->lk_heldnext) {
+                level = pi_bestwaiter(l);
+                if (level < best) {
+                        best = level;
+                }
+        }
+        if (best != curthread->t_inherited) {
+                thread_setinherited(curthread, best);
+        }
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * The guts of lock_acquire, also used by cv_wait to get the lock back.
+ * A thread cv_broadcast moved onto lk_wchan (see cv_broadcast) comes in
+ * here already counted in lk_waiters, and, in handoff mode, possibly
+ * already the owner.
+ */
+static
+void
+lock_get(struct lock *lock)
+{
+        struct thread *owner;
+        bool spun = false;
+#if OPT_LOCKSTAT
+        unsigned start = timer_getticks();
+        bool contended = false;
+#endif
 
         spinlock_acquire(&lock->lk_lock);
 
-        while(lock->owner_thread != NULL) {
+        if (curthread->t_requeued) {
+          curthread->t_requeued = false;
+          lock->lk_waiters--;
+#if OPT_LOCKSTAT
+          contended = true;
+#endif
+        }
 
+        /*
+         * In handoff mode the releasing thread may already have made
+         * us the owner by the time we wake up.
+         */
+        while(lock->owner_thread != NULL &&
+              lock->owner_thread != curthread) {
+#if OPT_LOCKSTAT
+          contended = true;
+#endif
+
+          /*
+           * Spin at most once per acquire, so an owner with a long
+           * critical section doesn't keep us spinning. In handoff
+           * mode, don't spin past threads already queued.
+           */
+          owner = lock->owner_thread;
+          if (!spun && lock_owner_running(owner) &&
+              (lock->lk_mode == LOCK_BARGE || lock->lk_waiters == 0)) {
+            spun = true;
+            lock->lk_spins++;
+            spinlock_release(&lock->lk_lock);
+            lock_spin(lock, owner);
+            spinlock_acquire(&lock->lk_lock);
+            continue;
+          }
+
+          lock->lk_blocks++;
+          lock->lk_waiters++;
+          pi_block(lock, owner);
           wchan_lock(lock->lk_wchan);
           spinlock_release(&lock->lk_lock);
           wchan_sleep(lock->lk_wchan);
           spinlock_acquire(&lock->lk_lock);
+          lock->lk_waiters--;
+          pi_unblock(lock);
 
         }
 
         lock->owner_thread = curthread;
+        if (lock->lk_piwaiters != NULL) {
+          pi_acquire(lock);
+        }
+#if OPT_LOCKSTAT
+        lockstat_acquired(&lock->lk_stat, start, contended);
+#endif
         spinlock_release(&lock->lk_lock);
+}
 
+void
+lock_acquire(struct lock *lock)
+{
+        // Write this
+        KASSERT(lock != NULL);
+        KASSERT(!lock_do_i_hold(lock));
+        KASSERT(curthread->t_in_interrupt == false);
+
+        lock_get(lock);
 }
 
 void
@@ -224,8 +513,28 @@ lock_release(struct lock *lock)
         KASSERT(curthread->t_in_interrupt == false);
 
         spinlock_acquire(&lock->lk_lock);
-        lock->owner_thread = NULL;
-        wchan_wakeone(lock->lk_wchan);
+#if OPT_LOCKSTAT
+        lockstat_released(&lock->lk_stat);
+#endif
+        if (lock->lk_piowner == curthread) {
+          pi_release(lock);
+        }
+        if (lock->lk_waiters == 0) {
+          /* Nobody to wake. */
+          lock->owner_thread = NULL;
+        }
+        else if (lock->lk_mode == LOCK_HANDOFF) {
+          /*
+           * The waiter can't look at owner_thread until we drop
+           * lk_lock, so it's fine to set it after waking it. If all
+           * the waiters are already awake, there's nobody to hand to.
+           */
+          lock->owner_thread = wchan_wakeone(lock->lk_wchan);
+        }
+        else {
+          lock->owner_thread = NULL;
+          wchan_wakeone(lock->lk_wchan);
+        }
         spinlock_release(&lock->lk_lock);
 }
 
@@ -265,6 +574,11 @@ cv_create(const char *name)
           return NULL;
         }
 
+#if OPT_LOCKSTAT
+        lockstat_init(&cv->cv_stat, cv);
+        lockstat_register(&cv->cv_stat, "cv", cv->cv_name);
+#endif
+
         return cv;
 }
 
@@ -274,6 +588,9 @@ cv_destroy(struct cv *cv)
         KASSERT(cv != NULL);
 
         // add stuff here as needed
+#if OPT_LOCKSTAT
+        lockstat_unregister(&cv->cv_stat);
+#endif
         wchan_destroy(cv->cv_chan);
         kfree(cv->cv_name);
         kfree(cv);
@@ -282,6 +599,10 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+#if OPT_LOCKSTAT
+        unsigned start = timer_getticks();
+#endif
+
         // Write this
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
@@ -290,7 +611,33 @@ cv_wait(struct cv *cv, struct lock *lock)
         wchan_lock(cv->cv_chan);
         lock_release(lock);
         wchan_sleep(cv->cv_chan);
-        lock_acquire(lock);
+        lock_get(lock);
+#if OPT_LOCKSTAT
+        /* Every wait is contended, and there's no hold time. */
+        lockstat_acquired(&cv->cv_stat, start, true);
+#endif
+}
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+        int result;
+#if OPT_LOCKSTAT
+        unsigned start = timer_getticks();
+#endif
+
+        KASSERT(cv != NULL);
+        KASSERT(lock != NULL);
+        KASSERT(lock_do_i_hold(lock));
+
+        wchan_lock(cv->cv_chan);
+        lock_release(lock);
+        result = wchan_timedsleep(cv->cv_chan, ticks);
+        lock_get(lock);
+#if OPT_LOCKSTAT
+        lockstat_acquired(&cv->cv_stat, start, true);
+#endif
+        return result;
 }
 
 void
@@ -312,5 +659,233 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         KASSERT(lock != NULL);
         KASSERT(lock_do_i_hold(lock));
 
-        wchan_wakeall(cv->cv_chan);
+        /*
+         * Waking everyone would just have them all pile onto the lock
+         * we hold, and all but one go back to sleep. Instead, move
+         * them straight onto the lock's wait channel as if they'd
+         * slept in lock_acquire; each lock_release then wakes one.
+         *
+         * Lock order is the same as cv_wait's: cv_chan, then lk_lock,
+         * then lk_wchan.
+         */
+        wchan_lock(cv->cv_chan);
+        spinlock_acquire(&lock->lk_lock);
+        lock->lk_waiters += wchan_requeue(cv->cv_chan, lock->lk_wchan);
+        spinlock_release(&lock->lk_lock);
+        wchan_unlock(cv->cv_chan);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmalloc(sizeof(struct rwlock));
+        if (rw == NULL) {
+                return NULL;
+        }
+
+        rw->rwlock_name = kstrdup(name);
+        if (rw->rwlock_name == NULL) {
+                kfree(rw);
+                return NULL;
+        }
+
+        rw->rw_rwchan = wchan_create(rw->rwlock_name);
+        if (rw->rw_rwchan == NULL) {
+                goto fail_name;
+        }
+        rw->rw_wwchan = wchan_create(rw->rwlock_name);
+        if (rw->rw_wwchan == NULL) {
+                goto fail_rwchan;
+        }
+        rw->rw_uwchan = wchan_create(rw->rwlock_name);
+        if (rw->rw_uwchan == NULL) {
+                goto fail_wwchan;
+        }
+
+        spinlock_init(&rw->rw_lock);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+        rw->rw_upgrader = NULL;
+
+        return rw;
+
+ fail_wwchan:
+        wchan_destroy(rw->rw_wwchan);
+ fail_rwchan:
+        wchan_destroy(rw->rw_rwchan);
+ fail_name:
+        kfree(rw->rwlock_name);
+        kfree(rw);
+        return NULL;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+        KASSERT(rw->rw_waitingwriters == 0);
+
+        spinlock_cleanup(&rw->rw_lock);
+        wchan_destroy(rw->rw_uwchan);
+        wchan_destroy(rw->rw_wwchan);
+        wchan_destroy(rw->rw_rwchan);
+        kfree(rw->rwlock_name);
+        kfree(rw);
+}
+
+/*
+ * Sleep on WC. Called and returns with rw_lock held.
+ */
+static
+void
+rwlock_sleep(struct rwlock *rw, struct wchan *wc)
+{
+        wchan_lock(wc);
+        spinlock_release(&rw->rw_lock);
+        wchan_sleep(wc);
+        spinlock_acquire(&rw->rw_lock);
+}
+
+/*
+ * The lock has just become free of readers or of a writer; wake
+ * whoever should go next: the upgrader, then a writer, then all the
+ * readers. Called with rw_lock held.
+ */
+static
+void
+rwlock_wakeup(struct rwlock *rw)
+{
+        KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+
+        if (rw->rw_writer != NULL) {
+                return;
+        }
+        if (rw->rw_upgrader != NULL) {
+                if (rw->rw_readers == 0) {
+                        wchan_wakeone(rw->rw_uwchan);
+                }
+                return;
+        }
+        if (rw->rw_readers > 0) {
+                return;
+        }
+        if (rw->rw_waitingwriters > 0) {
+                wchan_wakeone(rw->rw_wwchan);
+        }
+        else {
+                wchan_wakeall(rw->rw_rwchan);
+        }
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writer != curthread);
+        while (rw->rw_writer != NULL || rw->rw_upgrader != NULL ||
+               rw->rw_waitingwriters > 0) {
+                rwlock_sleep(rw, rw->rw_rwchan);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        rwlock_wakeup(rw);
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writer != curthread);
+        while (rw->rw_writer != NULL || rw->rw_upgrader != NULL ||
+               rw->rw_readers > 0) {
+                rw->rw_waitingwriters++;
+                rwlock_sleep(rw, rw->rw_wwchan);
+                rw->rw_waitingwriters--;
+        }
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writer == curthread);
+        rw->rw_writer = NULL;
+        rwlock_wakeup(rw);
+        spinlock_release(&rw->rw_lock);
+}
+
+int
+rwlock_upgrade(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_readers > 0);
+        KASSERT(rw->rw_writer == NULL);
+        if (rw->rw_upgrader != NULL) {
+                /* Waiting would deadlock: it's waiting for us. */
+                spinlock_release(&rw->rw_lock);
+                return EBUSY;
+        }
+
+        /*
+         * Give up our read lock, but keep everyone else out by
+         * being the upgrader, and wait for the other readers to go.
+         */
+        rw->rw_upgrader = curthread;
+        rw->rw_readers--;
+        while (rw->rw_readers > 0) {
+                rwlock_sleep(rw, rw->rw_uwchan);
+        }
+        rw->rw_upgrader = NULL;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_lock);
+        return 0;
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_lock);
+        KASSERT(rw->rw_writer == curthread);
+        rw->rw_writer = NULL;
+        rw->rw_readers++;
+        /* Other readers can join us, unless a writer is waiting. */
+        if (rw->rw_waitingwriters == 0) {
+                wchan_wakeall(rw->rw_rwchan);
+        }
+        spinlock_release(&rw->rw_lock);
 }
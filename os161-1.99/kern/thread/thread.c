@@ -41,6 +41,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <clock.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -57,6 +58,19 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Quantum, in hardclocks, for each scheduling level. Lower levels get
+ * longer slices since they are expected to be CPU-bound. Tunable at
+ * runtime with thread_setquantum.
+ */
+static unsigned sched_quantum[SCHED_NLEVELS] = { 1, 2, 4, 8 };
+
+/*
+ * How often (in hardclocks) every thread is boosted back to level 0.
+ * Also tunable; level SCHED_NLEVELS in thread_setquantum.
+ */
+static unsigned sched_boost_hardclocks = 100;
+
 /* Wait channel. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -112,26 +126,24 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set up the fields of a new or recycled thread. The stack, if any,
+ * is left alone. Fails only if a long name can't be allocated.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,10 +151,23 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
+	thread->t_wchan = NULL;
+	thread->t_requeued = false;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_ustack = -1;
+	thread->t_intrwchan = NULL;
+
+	/* Scheduler fields */
+	thread->t_priority = 0;
+	thread->t_inherited = SCHED_NLEVELS;
+	thread->t_runlevel = -1;
+	thread->t_ticks = 0;
+	thread->t_lastran = 0;
+	thread->t_blockedon = NULL;
+	thread->t_piwaitnext = NULL;
+	thread->t_heldlocks = NULL;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -151,6 +176,31 @@ thread_create(const char *name)
 
 	/* If you add to struct thread, be sure to initialize here */
 
+	return 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads. The new
+ * thread has no stack.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->t_stack = NULL;
+
+	if (thread_init(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+
 	return thread;
 }
 
@@ -168,6 +218,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -179,10 +230,18 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
+	c->c_lastboost = 0;
+	c->c_curas = NULL;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_steals = 0;
+	c->c_migrations = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -241,6 +300,7 @@ thread_destroy(struct thread *thread)
 {
 	KASSERT(thread != curthread);
 	KASSERT(thread->t_state != S_RUN);
+	KASSERT(thread->t_heldlocks == NULL);
 
 	/*
 	 * If you add things to struct thread, be sure to clean them up
@@ -258,10 +318,88 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
 	kfree(thread);
 }
 
+/*
+ * Thread cache.
+ *
+ * Rather than freeing dead threads, each cpu keeps up to
+ * THREAD_CACHE_MAX of them, stack and all, for thread_fork to reuse.
+ * The stack guard band is left in place, so a recycled thread needs
+ * no allocation at all unless its name is long. Threads without a
+ * stack (the boot thread) are never cached.
+ *
+ * The cache is per-cpu and only touched with interrupts off, so it
+ * needs no lock. The list is LIFO so the most recently used (and
+ * most likely cache-warm) stack is handed out first.
+ */
+
+/* Destroy ZOMBIE, or put what's left of it in the current cpu's cache. */
+static
+void
+thread_cache_put(struct thread *zombie)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(zombie->t_proc == NULL);
+
+	if (zombie->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		thread_destroy(zombie);
+		return;
+	}
+
+	thread_checkstack(zombie);
+	thread_machdep_cleanup(&zombie->t_machdep);
+	if (zombie->t_name != zombie->t_namebuf) {
+		kfree(zombie->t_name);
+	}
+	zombie->t_name = NULL;
+	zombie->t_wchan_name = "CACHED";
+	threadlist_addhead(&curcpu->c_threadcache, zombie);
+}
+
+/*
+ * Get a thread with a stack for thread_fork, from the current cpu's
+ * cache if possible.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread == NULL) {
+		thread = thread_create(name);
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = kmalloc(STACK_SIZE);
+		if (thread->t_stack == NULL) {
+			thread_destroy(thread);
+			return NULL;
+		}
+		thread_checkstack_init(thread);
+		return thread;
+	}
+
+	if (thread_init(thread, name)) {
+		/* The name was too long and we're out of memory. */
+		thread->t_name = thread->t_namebuf;
+		thread_destroy(thread);
+		return NULL;
+	}
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
@@ -277,7 +415,7 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_cache_put(z);
 	}
 }
 
@@ -289,6 +427,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +443,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +569,100 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+static bool thread_steal(unsigned minload);
+
+/*
+ * Run queue operations. The run queue of each cpu is an array of
+ * thread lists, one per scheduling level; c_runcount is the total.
+ * The caller must hold the cpu's runqueue lock.
+ */
+
+/* Add T at the tail of its (effective) level on cpu C. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority >= 0 && t->t_priority < SCHED_NLEVELS);
+	KASSERT(t->t_runlevel == -1);
+
+	t->t_runlevel = thread_effpriority(t);
+	threadlist_addtail(&c->c_runqueue[t->t_runlevel], t);
+	c->c_runcount++;
+}
+
+/* Return the highest-priority level with a runnable thread. */
+static
+int
+runqueue_toplevel(struct cpu *c)
+{
+	int i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return i;
+		}
+	}
+	return SCHED_NLEVELS;
+}
+
+/* Take the next thread to run: the head of the highest nonempty level. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	int level;
+
+	level = runqueue_toplevel(c);
+	if (level == SCHED_NLEVELS) {
+		return NULL;
+	}
+	c->c_runcount--;
+	t = threadlist_remhead(&c->c_runqueue[level]);
+	t->t_runlevel = -1;
+	return t;
+}
+
+/* Take the thread least deserving of the cpu, for migration. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	int i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NLEVELS-1; i>=0; i--) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			c->c_runcount--;
+			t = threadlist_remtail(&c->c_runqueue[i]);
+			t->t_runlevel = -1;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Move thread T to scheduling level LEVEL, restarting its quantum.
+ * T must not be on a run queue.
+ */
+static
+void
+thread_setlevel(struct thread *t, int level)
+{
+	if (level != t->t_priority) {
+		DEBUG(DB_THREADS, "Thread %s: priority %d -> %d\n",
+		      t->t_name, t->t_priority, level);
+		t->t_priority = level;
+	}
+	t->t_ticks = 0;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -450,7 +687,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -484,22 +721,16 @@ thread_fork(const char *name,
 	int result;
 
 #ifdef UW
-	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
+	DEBUG(DB_THREADS,"Forking thread: %s (priority %d)\n",
+	      name, curthread->t_priority);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Get a thread, with a stack, preferably a recycled one */
+	newthread = thread_cache_get(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
@@ -507,6 +738,12 @@ thread_fork(const char *name,
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
 
+	/*
+	 * Scheduler fields. The new thread starts at its parent's
+	 * level; it has done nothing yet to earn a better one.
+	 */
+	newthread->t_priority = curthread->t_priority;
+
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
 		proc = curthread->t_proc;
@@ -548,6 +785,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	bool ticking;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -573,13 +811,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing else at our priority or
+	 * better is waiting, just return. (This also guarantees that
+	 * a yielding thread is never picked to replace itself.)
+	 */
+	if (newstate == S_READY &&
+	    runqueue_toplevel(curcpu) > thread_effpriority(cur)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+	/* Remember when it stopped running, for cache affinity. */
+	cur->t_lastran = curcpu->c_hardclocks;
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -589,6 +835,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -613,7 +860,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal
+	 * one from another cpu, and failing that call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -629,17 +877,35 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	/*
+	 * An idle cpu has no use for hardclock, so stop it while we
+	 * wait; anything that gives us work sends an IPI, and other
+	 * cpus with a backlog send one too (see
+	 * thread_consider_migration). Start it again once we have a
+	 * thread to run.
+	 */
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	ticking = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal(1)) {
+				if (ticking) {
+					mainbus_hardclock_stop();
+					ticking = false;
+				}
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	if (!ticking) {
+		mainbus_hardclock_start();
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -822,139 +1088,374 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has SCHED_NLEVELS
+ * run queues and always runs the first thread of the highest-priority
+ * nonempty one; threads within a level take turns.
+ *
+ *    - New threads start at their parent's level.
+ *    - A thread that runs for a whole quantum of its level is demoted
+ *      one level (and the quanta get longer further down).
+ *    - A thread that sleeps and is woken up is promoted one level, so
+ *      threads that mostly wait for I/O or for each other stay near
+ *      the top.
+ *    - Every sched_boost_hardclocks, schedule() moves everything back
+ *      to level 0 so CPU-bound threads cannot starve for good and
+ *      threads whose behavior changes get reclassified.
+ *    - A thread holding a lock that better-placed threads are waiting
+ *      for runs at the best of their levels (priority inheritance,
+ *      managed by synch.c), so it can't be held up by threads in
+ *      between.
  */
 
+/*
+ * Get and set the scheduler tunables: the quantum of level LEVEL, or
+ * for LEVEL == SCHED_NLEVELS, the boost interval. The values are
+ * read without locking; a change takes effect at the next tick.
+ */
+unsigned
+thread_getquantum(int level)
+{
+	KASSERT(level >= 0 && level <= SCHED_NLEVELS);
+	if (level == SCHED_NLEVELS) {
+		return sched_boost_hardclocks;
+	}
+	return sched_quantum[level];
+}
+
+int
+thread_setquantum(int level, unsigned hardclocks)
+{
+	if (level < 0 || level > SCHED_NLEVELS || hardclocks == 0) {
+		return EINVAL;
+	}
+	if (level == SCHED_NLEVELS) {
+		sched_boost_hardclocks = hardclocks;
+	}
+	else {
+		sched_quantum[level] = hardclocks;
+	}
+	return 0;
+}
+
 void
-schedule(void)
+thread_setpriority(int level)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	int spl;
+
+	KASSERT(level >= 0 && level < SCHED_NLEVELS);
+
+	/* Only this cpu's timer touches our level while we run. */
+	spl = splhigh();
+	thread_setlevel(curthread, level);
+	splx(spl);
+}
+
+int
+thread_effpriority(const struct thread *t)
+{
+	return t->t_inherited < t->t_priority ? t->t_inherited : t->t_priority;
 }
 
 /*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * If T is in transit between CPUs (see thread_steal) we miss it, and
+ * it goes on its new run queue wherever its levels were when the
+ * stealer looked; it gets put right the next time it runs.
  */
 void
-thread_consider_migration(void)
+thread_setinherited(struct thread *t, int level)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+	KASSERT(level >= 0 && level <= SCHED_NLEVELS);
+
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	t->t_inherited = level;
+	if (t->t_cpu == c && t->t_runlevel >= 0 &&
+	    t->t_runlevel != thread_effpriority(t)) {
+		threadlist_remove(&c->c_runqueue[t->t_runlevel], t);
+		c->c_runcount--;
+		t->t_runlevel = -1;
+		runqueue_add(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Called from hardclock() on every tick, with interrupts off.
+ */
+void
+thread_timeslice(void)
+{
+	struct thread *cur;
+	bool preempt;
+
+	/*
+	 * If the timer interrupted the idle loop, curthread is not
+	 * really running and has nothing to be charged for.
+	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	cur->t_ticks++;
+	if (cur->t_ticks >= sched_quantum[cur->t_priority]) {
+		/* Used up its quantum: demote, and go to the back. */
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			thread_setlevel(cur, cur->t_priority + 1);
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		else {
+			cur->t_ticks = 0;
+		}
+		thread_yield();
+		return;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	/* Otherwise, only make way for a higher-priority thread. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	preempt = runqueue_toplevel(curcpu) < thread_effpriority(cur);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queues by periodically boosting all threads to the top
+ * level.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	if (curcpu->c_hardclocks - curcpu->c_lastboost <
+	    sched_boost_hardclocks) {
 		return;
 	}
+	curcpu->c_lastboost = curcpu->c_hardclocks;
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			thread_setlevel(t, 0);
+			t->t_runlevel = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	if (!curcpu->c_isidle) {
+		thread_setlevel(curthread, 0);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
+/*
+ * Work stealing.
+ *
+ * Threads move between CPUs only by being stolen: a CPU that runs out
+ * of work, or has well under its share, takes a waiting thread from
+ * the most heavily loaded other CPU. The CPU that wants work does the
+ * looking, so a busy CPU never spends time on anyone else's run
+ * queue. Only the victim's run queue lock is taken, and never
+ * together with our own, so there is no lock ordering to worry about.
+ *
+ * Migrating threads isn't free because of cache affinity; a thread's
+ * working cache set will end up having to be moved to the other CPU.
+ * A thread that stopped running on the victim less than
+ * STEAL_HOT_HARDCLOCKS ticks ago is assumed to be cache-hot there and
+ * is left alone. Among the rest we take the lowest-priority thread,
+ * which is the one the victim would have got around to last.
+ */
+#define STEAL_HOT_HARDCLOCKS	2
+
+/*
+ * Try to move one thread from another cpu with at least MINLOAD
+ * threads waiting onto our run queue. Called without our runqueue
+ * lock held. Returns true if a thread was stolen.
+ */
+static
+bool
+thread_steal(unsigned minload)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	struct threadlistnode *tln;
+	unsigned i, numcpus, load;
+	int level;
+
+	/*
+	 * Pick the victim from an unlocked snapshot of the queue
+	 * lengths. It may be stale by the time we lock the victim;
+	 * that costs at most a fruitless look at its queue. Idle CPUs
+	 * are skipped: anything on their queue is about to run.
+	 */
+	victim = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
+		if (c == curcpu->c_self || c->c_isidle) {
 			continue;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+		load = c->c_runcount;
+		if (load >= minload) {
+			victim = c;
+			minload = load + 1;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	t = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (level = SCHED_NLEVELS-1; level >= 0 && t == NULL; level--) {
+		for (tln = victim->c_runqueue[level].tl_tail.tln_prev;
+		     tln->tln_prev != NULL; tln = tln->tln_prev) {
 			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
+			 * The victim's curthread can appear on its
+			 * run queue if it went to sleep, the victim
+			 * went idle, and it was woken up again before
+			 * the victim finished unidling. Migrating it
+			 * would be a disaster; leave it be.
 			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
+			if (tln->tln_self == victim->c_curthread) {
 				continue;
 			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+			if (victim->c_hardclocks - tln->tln_self->t_lastran <
+			    STEAL_HOT_HARDCLOCKS) {
+				continue;
 			}
+			t = tln->tln_self;
+			threadlist_remove(&victim->c_runqueue[level], t);
+			t->t_runlevel = -1;
+			victim->c_runcount--;
+			victim->c_migrations++;
+			break;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
 	}
 
 	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
+	 * T is on no list at this point, but it is S_READY, and only
+	 * run queue code touches ready threads, so nobody else can be
+	 * looking for it. Count it as having just run here so it
+	 * doesn't immediately get stolen back.
 	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_cpu = curcpu->c_self;
+	t->t_lastran = curcpu->c_hardclocks;
+	runqueue_add(curcpu, t);
+	curcpu->c_steals++;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s (priority %d): cpu %u -> %u\n",
+	      t->t_name, t->t_priority, victim->c_number, curcpu->c_number);
+	return true;
+}
+
+/*
+ * Load balancing.
+ *
+ * This is called periodically from hardclock(). Idle CPUs steal for
+ * themselves in the idle loop; this handles busy CPUs whose load has
+ * drifted out of balance. A CPU with less than its share pulls a
+ * thread from the busiest other CPU; a CPU with threads waiting wakes
+ * an idle CPU so that it will come and steal one.
+ *
+ * The queue lengths are read without locking; a wrong guess only
+ * costs a wasted steal attempt or a spurious wakeup.
+ */
+void
+thread_consider_migration(void)
+{
+	unsigned my_count, total_count, one_share;
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	total_count = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		total_count += c->c_runcount;
+	}
+	one_share = DIVROUNDUP(total_count, numcpus);
+	my_count = curcpu->c_runcount;
+
+	if (my_count < one_share) {
+		/* Only worth moving a thread if it evens things out. */
+		thread_steal(my_count + 2);
+		return;
+	}
+
+	if (my_count > 0) {
+		for (i=0; i<numcpus; i++) {
+			c = cpuarray_get(&allcpus, i);
+			if (c != curcpu->c_self && c->c_isidle) {
+				ipi_send(c, IPI_UNIDLE);
+				break;
+			}
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
 	}
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+/*
+ * Forget AS on every cpu that last activated it.
+ *
+ * No thread is using AS anymore, so no cpu can be activating it
+ * concurrently, and clearing another cpu's c_curas is safe without a
+ * lock: the worst that can happen is an unnecessary TLB flush.
+ */
+void
+cpu_forget_as(struct addrspace *as)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c->c_curas == as) {
+			c->c_curas = NULL;
+		}
+	}
+}
+
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Print per-cpu scheduler statistics. The numbers are read without
+ * locking and are only a snapshot.
+ */
+void
+cpu_printstats(void)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("cpu%u: %s, %u queued, %u hardclocks, "
+			"%u stolen, %u migrated away\n",
+			c->c_number, c->c_isidle ? "idle" : "busy",
+			c->c_runcount, c->c_hardclocks,
+			c->c_steals, c->c_migrations);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1029,9 +1530,90 @@ wchan_sleep(struct wchan *wc)
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Reward a thread that slept by moving it up a scheduling level.
+ */
+static
+void
+thread_wakeboost(struct thread *t)
+{
+	if (t->t_priority > 0) {
+		thread_setlevel(t, t->t_priority - 1);
+	}
+}
+
+/*
+ * Wake up thread T if it is sleeping on wait channel WC. Returns true
+ * if it was.
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct thread *t)
+{
+	spinlock_acquire(&wc->wc_lock);
+	if (t->t_wchan != wc) {
+		spinlock_release(&wc->wc_lock);
+		return false;
+	}
+	threadlist_remove(&wc->wc_threads, t);
+	t->t_wchan = NULL;
+	spinlock_release(&wc->wc_lock);
+
+	thread_wakeboost(t);
+	thread_make_runnable(t, false);
+	return true;
+}
+
+/*
+ * Timed sleep. The timeout wakes the sleeper the same way anyone
+ * else would, and notes that it did so.
  */
+struct wchan_timer {
+	struct wchan *wt_wchan;
+	struct thread *wt_thread;
+	bool wt_expired;
+};
+
+static
 void
+wchan_timer_expire(void *data)
+{
+	struct wchan_timer *wt = data;
+
+	wt->wt_expired = wchan_wakethread(wt->wt_wchan, wt->wt_thread);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS timer ticks. Returns
+ * ETIMEDOUT if the time ran out, 0 if woken by someone else.
+ */
+int
+wchan_timedsleep(struct wchan *wc, unsigned ticks)
+{
+	struct wchan_timer wt;
+	struct timeout to;
+
+	KASSERT(spinlock_do_i_hold(&wc->wc_lock));
+
+	wt.wt_wchan = wc;
+	wt.wt_thread = curthread;
+	wt.wt_expired = false;
+	timeout_init(&to, wchan_timer_expire, &wt);
+
+	/*
+	 * The timeout can't wake us before we're asleep: waking takes
+	 * the channel lock, which we hold until we're on the list.
+	 */
+	timeout_add(&to, ticks);
+	wchan_sleep(wc);
+
+	/* Make sure the timeout is gone before WT and TO go away. */
+	timeout_cancel(&to);
+	return wt.wt_expired ? ETIMEDOUT : 0;
+}
+
+/*
+ * Wake up one thread sleeping on a wait channel, and return it.
+ */
+struct thread *
 wchan_wakeone(struct wchan *wc)
 {
 	struct thread *target;
@@ -1039,6 +1621,9 @@ wchan_wakeone(struct wchan *wc)
 	/* Lock the channel and grab a thread from it */
 	spinlock_acquire(&wc->wc_lock);
 	target = threadlist_remhead(&wc->wc_threads);
+	if (target != NULL) {
+		target->t_wchan = NULL;
+	}
 	/*
 	 * Nobody else can wake up this thread now, so we don't need
 	 * to hang onto the lock.
@@ -1047,10 +1632,12 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
+	thread_wakeboost(target);
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1070,6 +1657,7 @@ wchan_wakeall(struct wchan *wc)
 	 */
 	spinlock_acquire(&wc->wc_lock);
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 	/*
@@ -1084,12 +1672,38 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeboost(target);
 		thread_make_runnable(target, false);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move all threads sleeping on FROM to TO, without waking them.
+ */
+unsigned
+wchan_requeue(struct wchan *from, struct wchan *to)
+{
+	struct thread *target;
+	unsigned count = 0;
+
+	KASSERT(spinlock_do_i_hold(&from->wc_lock));
+	KASSERT(from != to);
+
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan = to;
+		target->t_wchan_name = to->wc_name;
+		target->t_requeued = true;
+		threadlist_addtail(&to->wc_threads, target);
+		count++;
+	}
+	spinlock_release(&to->wc_lock);
+
+	return count;
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
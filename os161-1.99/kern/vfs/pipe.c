@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Pipes.
+ *
+ * The data lives in a ring buffer indexed by two free-running
+ * counters: p_head counts bytes ever written and p_tail bytes ever
+ * read, so the ring holds p_head - p_tail bytes. Only the writer
+ * touches p_head and only the reader touches p_tail, so as long as
+ * there is one of each they share the ring without any lock. (The
+ * counters are volatile; System/161 doesn't reorder memory accesses,
+ * so nothing more is needed to publish data before the counter.)
+ *
+ * Several processes can hold the same end, though, after a fork or
+ * dup2. Each end therefore admits one thread at a time through a
+ * benaphore: an atomic count of threads using the end, backed by a
+ * wchan that is only touched when the count shows contention. A
+ * thread leaving hands the end on by posting a grant for one of the
+ * waiters. Waiting for the end is interruptible like everything else
+ * here; a waiter that gives up stays in the count, and whoever would
+ * have handed it the end leaves on its behalf instead.
+ *
+ * A reader that finds the ring empty, or a writer that finds it full,
+ * sleeps on a wchan. It raises its "sleeping" flag and rechecks the
+ * ring with the wchan locked; the other side moves its counter and
+ * then checks the flag, waking the wchan (which waits for the wchan
+ * lock) if it's up. One side or the other always sees the other's
+ * update, so no wakeup is lost. These sleeps are interruptible (see
+ * proc_sleepbegin), so a process can exit while blocked on a pipe;
+ * the read or write then fails with EINTR.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <current.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <proc.h>
+#include <pipe.h>
+
+/* One end of a pipe. */
+struct pipe_end {
+	struct vnode pe_vnode;
+	volatile spinlock_data_t pe_users;	/* threads in or waiting */
+	struct wchan *pe_wait;			/* for contended pe_users */
+	unsigned pe_grants;			/* handoffs not yet taken */
+	unsigned pe_cancelled;			/* waiters that gave up */
+};
+
+struct pipe {
+	char *p_buf;
+	size_t p_size;				/* power of two */
+	volatile unsigned p_head;		/* bytes written; writer only */
+	volatile unsigned p_tail;		/* bytes read; reader only */
+
+	struct pipe_end p_read;
+	struct pipe_end p_write;
+	volatile bool p_readers;		/* read end still open */
+	volatile bool p_writers;		/* write end still open */
+
+	struct wchan *p_readwait;		/* ring empty */
+	struct wchan *p_writewait;		/* ring full */
+	volatile bool p_readsleeping;
+	volatile bool p_writesleeping;
+
+	unsigned p_ends;			/* ends not yet reclaimed */
+};
+
+/*
+ * Admit one thread at a time to an end of the pipe. Fails with EINTR
+ * if the process exits while we wait.
+ */
+static
+int
+pipe_enter(struct pipe_end *pe)
+{
+	bool began;
+	int result;
+
+	if (spinlock_data_fetchadd(&pe->pe_users, 1) == 0) {
+		return 0;
+	}
+
+	began = proc_sleepbegin(pe->pe_wait) == 0;
+	wchan_lock(pe->pe_wait);
+	while (began && pe->pe_grants == 0 && !curproc->p_exiting) {
+		proc_sleep(pe->pe_wait);
+		wchan_lock(pe->pe_wait);
+	}
+	if (pe->pe_grants > 0) {
+		pe->pe_grants--;
+		result = 0;
+	}
+	else {
+		/* Keep our place in pe_users; pipe_leave drops it. */
+		pe->pe_cancelled++;
+		result = EINTR;
+	}
+	wchan_unlock(pe->pe_wait);
+	if (began) {
+		proc_sleepend();
+	}
+	return result;
+}
+
+static
+void
+pipe_leave(struct pipe_end *pe)
+{
+	while (spinlock_data_fetchadd(&pe->pe_users, (unsigned)-1) > 1) {
+		wchan_lock(pe->pe_wait);
+		if (pe->pe_cancelled > 0) {
+			/* Next in line gave up; leave for it too. */
+			pe->pe_cancelled--;
+			wchan_unlock(pe->pe_wait);
+			continue;
+		}
+		pe->pe_grants++;
+		wchan_unlock(pe->pe_wait);
+		wchan_wakeone(pe->pe_wait);
+		break;
+	}
+}
+
+/*
+ * Called for each open(). Pipes are only ever opened by pipe_create.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Called on the last close() of an end. Wake up anyone on the other
+ * end who was waiting for us, so they see EOF or EPIPE.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	if (v == &p->p_read.pe_vnode) {
+		p->p_readers = false;
+		wchan_wakeall(p->p_writewait);
+	}
+	else {
+		p->p_writers = false;
+		wchan_wakeall(p->p_readwait);
+	}
+	return 0;
+}
+
+/*
+ * Called when an end's refcount reaches zero. The pipe goes away
+ * with the second end. Both calls happen under the vfs big lock,
+ * so p_ends needs no lock of its own.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	VOP_CLEANUP(v);
+	KASSERT(p->p_ends > 0);
+	if (--p->p_ends > 0) {
+		return 0;
+	}
+
+	KASSERT(!p->p_readers && !p->p_writers);
+	wchan_destroy(p->p_readwait);
+	wchan_destroy(p->p_writewait);
+	wchan_destroy(p->p_read.pe_wait);
+	wchan_destroy(p->p_write.pe_wait);
+	kfree(p->p_buf);
+	kfree(p);
+	return 0;
+}
+
+/*
+ * Read: wait until there's data or no writer, then take as much as
+ * is there, up to what was asked for. Returns 0 bytes at EOF.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, off;
+	size_t n;
+	int result = 0;
+
+	if (v != &p->p_read.pe_vnode) {
+		return EBADF;
+	}
+
+	result = pipe_enter(&p->p_read);
+	if (result) {
+		return result;
+	}
+
+	tail = p->p_tail;
+	while ((head = p->p_head) == tail && p->p_writers) {
+		result = proc_sleepbegin(p->p_readwait);
+		if (result) {
+			pipe_leave(&p->p_read);
+			return result;
+		}
+		wchan_lock(p->p_readwait);
+		p->p_readsleeping = true;
+		if (p->p_head == tail && p->p_writers) {
+			proc_sleep(p->p_readwait);
+		}
+		else {
+			wchan_unlock(p->p_readwait);
+		}
+		p->p_readsleeping = false;
+		proc_sleepend();
+	}
+
+	/* At most two pieces, if the data wraps around the ring. */
+	while (tail != head && uio->uio_resid > 0) {
+		off = tail & (p->p_size - 1);
+		n = head - tail;
+		if (n > p->p_size - off) {
+			n = p->p_size - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+		tail += n;
+	}
+	p->p_tail = tail;
+
+	if (p->p_writesleeping) {
+		wchan_wakeall(p->p_writewait);
+	}
+
+	pipe_leave(&p->p_read);
+	return result;
+}
+
+/*
+ * Write: copy in as much as fits, waiting for the reader to make room
+ * as needed, until it's all written or the read end is gone.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	unsigned head, tail, off;
+	size_t n;
+	int result = 0;
+
+	if (v != &p->p_write.pe_vnode) {
+		return EBADF;
+	}
+
+	result = pipe_enter(&p->p_write);
+	if (result) {
+		return result;
+	}
+
+	head = p->p_head;
+	while (uio->uio_resid > 0) {
+		if (!p->p_readers) {
+			result = EPIPE;
+			break;
+		}
+
+		tail = p->p_tail;
+		if (head - tail == p->p_size) {
+			result = proc_sleepbegin(p->p_writewait);
+			if (result) {
+				break;
+			}
+			wchan_lock(p->p_writewait);
+			p->p_writesleeping = true;
+			if (head - p->p_tail == p->p_size && p->p_readers) {
+				proc_sleep(p->p_writewait);
+			}
+			else {
+				wchan_unlock(p->p_writewait);
+			}
+			p->p_writesleeping = false;
+			proc_sleepend();
+			continue;
+		}
+
+		off = head & (p->p_size - 1);
+		n = p->p_size - (head - tail);
+		if (n > p->p_size - off) {
+			n = p->p_size - off;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, n, uio);
+		if (result) {
+			break;
+		}
+		head += n;
+		p->p_head = head;
+
+		if (p->p_readsleeping) {
+			wchan_wakeall(p->p_readwait);
+		}
+	}
+
+	pipe_leave(&p->p_write);
+	return result;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * The size of a pipe is however much is waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_size = p->p_head - p->p_tail;
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = p->p_size;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Pipes have no name, and no directory operations.
+ */
+
+static
+int
+pipe_nouio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *dir, char *pathname, struct vnode **result)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *dir, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)dir;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes. Both ends share it.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_nouio,	/* readlink */
+	pipe_nouio,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_nouio,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+/*
+ * Set up one end. Leaves it referenced and open, as vfs_open would.
+ */
+static
+int
+pipe_end_init(struct pipe *p, struct pipe_end *pe, const char *name)
+{
+	int result;
+
+	pe->pe_users = 0;
+	pe->pe_grants = pe->pe_cancelled = 0;
+	pe->pe_wait = wchan_create(name);
+	if (pe->pe_wait == NULL) {
+		return ENOMEM;
+	}
+	result = VOP_INIT(&pe->pe_vnode, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		wchan_destroy(pe->pe_wait);
+		return result;
+	}
+	VOP_INCOPEN(&pe->pe_vnode);
+	return 0;
+}
+
+/*
+ * Make a pipe.
+ */
+int
+pipe_create(size_t size, struct vnode **readvn, struct vnode **writevn)
+{
+	struct pipe *p;
+	int result;
+
+	KASSERT(size > 0 && (size & (size - 1)) == 0);
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(size);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_size = size;
+	p->p_head = p->p_tail = 0;
+	p->p_readsleeping = p->p_writesleeping = false;
+
+	p->p_readwait = wchan_create("pipe read");
+	if (p->p_readwait == NULL) {
+		result = ENOMEM;
+		goto fail_buf;
+	}
+	p->p_writewait = wchan_create("pipe write");
+	if (p->p_writewait == NULL) {
+		result = ENOMEM;
+		goto fail_readwait;
+	}
+	result = pipe_end_init(p, &p->p_read, "pipe reader");
+	if (result) {
+		goto fail_writewait;
+	}
+	result = pipe_end_init(p, &p->p_write, "pipe writer");
+	if (result) {
+		VOP_DECOPEN(&p->p_read.pe_vnode);
+		VOP_CLEANUP(&p->p_read.pe_vnode);
+		wchan_destroy(p->p_read.pe_wait);
+		goto fail_writewait;
+	}
+	p->p_readers = p->p_writers = true;
+	p->p_ends = 2;
+
+	*readvn = &p->p_read.pe_vnode;
+	*writevn = &p->p_write.pe_vnode;
+	return 0;
+
+ fail_writewait:
+	wchan_destroy(p->p_writewait);
+ fail_readwait:
+	wchan_destroy(p->p_readwait);
+ fail_buf:
+	kfree(p->p_buf);
+	kfree(p);
+	return result;
+}
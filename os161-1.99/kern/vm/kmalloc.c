@@ -31,6 +31,7 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-kmalloctrace.h"
 
 /*
  * Kernel malloc.
@@ -598,29 +599,308 @@ subpage_kfree(void *ptr)
 //
 ////////////////////////////////////////////////////////////
 
+/*
+ * Allocate whole pages for a request too big for the subpage
+ * allocator.
+ */
+static
 void *
-kmalloc(size_t sz)
+bigpage_kmalloc(size_t sz)
 {
-	if (sz>=LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
+	unsigned long npages;
+	vaddr_t address;
+
+	/* Round up to a whole number of pages. */
+	npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
+	}
+
+	return (void *)address;
+}
+
+#if OPT_KMALLOCTRACE
+////////////////////////////////////////////////////////////
+//
+// Per-callsite allocation accounting.
+//
+//    Each allocation is charged to the return address of whoever
+//    called kmalloc. Subpage blocks carry a small header in front of
+//    the returned pointer that records the callsite slot and the
+//    requested size; since blocks are aligned to their size, a
+//    returned pointer is then never page-aligned. Whole-page
+//    allocations are kept page-aligned (kfree relies on that) and are
+//    remembered in a separate fixed table instead.
+//
+//    Everything lives in the BSS so the accounting never has to call
+//    back into kmalloc. If a table fills up, the extra callsites are
+//    lumped together in the last slot and untracked page allocations
+//    are just counted.
+//
+
+#define KMT_NSITES	256		/* callsite slots */
+#define KMT_OVERFLOW	(KMT_NSITES-1)	/* catch-all slot, never claimed */
+#define KMT_NBIG	128		/* tracked page allocations */
+#define KMT_MAGIC	0x6b74		/* "kt" */
+
+struct kmt_site {
+	vaddr_t ks_callsite;		/* caller's return address; 0 = unused */
+	unsigned ks_livecount;		/* blocks currently allocated */
+	size_t ks_livebytes;		/* bytes currently allocated */
+	unsigned ks_allocs;		/* allocations ever made */
+};
+
+struct kmt_header {
+	uint16_t kh_magic;
+	uint16_t kh_site;		/* index into kmt_sites[] */
+	uint32_t kh_size;		/* size requested by the caller */
+};
+
+struct kmt_big {
+	vaddr_t kb_addr;		/* 0 = unused */
+	uint16_t kb_site;
+	size_t kb_size;
+};
+
+/* The header must not break the 8-byte alignment kmalloc promises. */
+#define KMT_HDRSIZE	sizeof(struct kmt_header)
+
+static struct kmt_site kmt_sites[KMT_NSITES];
+static struct kmt_big kmt_bigs[KMT_NBIG];
+static unsigned kmt_untracked;		/* page allocations not in kmt_bigs */
+static struct spinlock kmt_spinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Find (or claim) the slot for CALLSITE. Open addressing with linear
+ * probing; slots are never released, so a lookup can stop at the
+ * first unused slot.
+ */
+static
+unsigned
+kmt_findsite(vaddr_t callsite)
+{
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&kmt_spinlock));
+
+	/* instructions are word-aligned; don't waste the low bits */
+	i = (callsite >> 2) % KMT_OVERFLOW;
+	for (n=0; n<KMT_OVERFLOW; n++) {
+		if (kmt_sites[i].ks_callsite == callsite) {
+			return i;
+		}
+		if (kmt_sites[i].ks_callsite == 0) {
+			kmt_sites[i].ks_callsite = callsite;
+			return i;
+		}
+		i = (i+1) % KMT_OVERFLOW;
+	}
+	return KMT_OVERFLOW;
+}
+
+static
+void
+kmt_charge(unsigned site, size_t sz)
+{
+	KASSERT(spinlock_do_i_hold(&kmt_spinlock));
+
+	kmt_sites[site].ks_livecount++;
+	kmt_sites[site].ks_livebytes += sz;
+	kmt_sites[site].ks_allocs++;
+}
 
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
+static
+void
+kmt_uncharge(unsigned site, size_t sz)
+{
+	KASSERT(spinlock_do_i_hold(&kmt_spinlock));
+	KASSERT(site < KMT_NSITES);
+	KASSERT(kmt_sites[site].ks_livecount > 0);
+	KASSERT(kmt_sites[site].ks_livebytes >= sz);
+
+	kmt_sites[site].ks_livecount--;
+	kmt_sites[site].ks_livebytes -= sz;
+}
+
+static
+void *
+kmt_kmalloc(size_t sz, vaddr_t callsite)
+{
+	struct kmt_header *kh;
+	unsigned site, i;
+	void *ptr;
+
+	if (sz + KMT_HDRSIZE >= LARGEST_SUBPAGE_SIZE) {
+		ptr = bigpage_kmalloc(sz);
+		if (ptr == NULL) {
 			return NULL;
 		}
+		spinlock_acquire(&kmt_spinlock);
+		site = kmt_findsite(callsite);
+		for (i=0; i<KMT_NBIG; i++) {
+			if (kmt_bigs[i].kb_addr == 0) {
+				kmt_bigs[i].kb_addr = (vaddr_t)ptr;
+				kmt_bigs[i].kb_site = site;
+				kmt_bigs[i].kb_size = sz;
+				kmt_charge(site, sz);
+				break;
+			}
+		}
+		if (i == KMT_NBIG) {
+			kmt_untracked++;
+		}
+		spinlock_release(&kmt_spinlock);
+		return ptr;
+	}
+
+	kh = subpage_kmalloc(sz + KMT_HDRSIZE);
+	if (kh == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&kmt_spinlock);
+	site = kmt_findsite(callsite);
+	kmt_charge(site, sz);
+	spinlock_release(&kmt_spinlock);
+
+	kh->kh_magic = KMT_MAGIC;
+	kh->kh_site = site;
+	kh->kh_size = sz;
+	return kh + 1;
+}
+
+static
+void
+kmt_kfree(void *ptr)
+{
+	struct kmt_header *kh;
+	unsigned i;
+
+	if ((vaddr_t)ptr % PAGE_SIZE == 0) {
+		/* Whole pages; look it up in the big table. */
+		spinlock_acquire(&kmt_spinlock);
+		for (i=0; i<KMT_NBIG; i++) {
+			if (kmt_bigs[i].kb_addr == (vaddr_t)ptr) {
+				kmt_uncharge(kmt_bigs[i].kb_site,
+					     kmt_bigs[i].kb_size);
+				kmt_bigs[i].kb_addr = 0;
+				break;
+			}
+		}
+		if (i == KMT_NBIG) {
+			KASSERT(kmt_untracked > 0);
+			kmt_untracked--;
+		}
+		spinlock_release(&kmt_spinlock);
+		free_kpages((vaddr_t)ptr);
+		return;
+	}
+
+	kh = (struct kmt_header *)ptr - 1;
+	if (kh->kh_magic != KMT_MAGIC || kh->kh_site >= KMT_NSITES) {
+		panic("kfree: bad or missing header at %p\n", ptr);
+	}
+
+	spinlock_acquire(&kmt_spinlock);
+	kmt_uncharge(kh->kh_site, kh->kh_size);
+	spinlock_release(&kmt_spinlock);
+
+	if (subpage_kfree(kh)) {
+		panic("kfree: %p is not a subpage block\n", ptr);
+	}
+}
+
+/*
+ * Print the NUM callsites with the most live bytes. Feed the
+ * addresses to addr2line on the kernel image to get source lines.
+ */
+void
+kheap_printcallers(unsigned num)
+{
+	struct kmt_site top[KHEAP_MAXCALLERS];
+	unsigned ntop, i, j, untracked;
+	size_t totbytes;
+	unsigned totcount;
+
+	if (num > KHEAP_MAXCALLERS) {
+		num = KHEAP_MAXCALLERS;
+	}
+
+	/*
+	 * Collect the top entries (insertion sort into top[]) with
+	 * the lock held, then print them without it.
+	 */
+	ntop = 0;
+	totbytes = 0;
+	totcount = 0;
+	spinlock_acquire(&kmt_spinlock);
+	for (i=0; i<KMT_NSITES; i++) {
+		if (kmt_sites[i].ks_livecount == 0) {
+			continue;
+		}
+		totbytes += kmt_sites[i].ks_livebytes;
+		totcount += kmt_sites[i].ks_livecount;
+		for (j = ntop; j > 0; j--) {
+			if (top[j-1].ks_livebytes >= kmt_sites[i].ks_livebytes) {
+				break;
+			}
+			if (j < num) {
+				top[j] = top[j-1];
+			}
+		}
+		if (j < num) {
+			top[j] = kmt_sites[i];
+			if (ntop < num) {
+				ntop++;
+			}
+		}
+	}
+	untracked = kmt_untracked;
+	spinlock_release(&kmt_spinlock);
+
+	kprintf("kmalloc: %u live blocks, %lu bytes, by callsite:\n",
+		totcount, (unsigned long) totbytes);
+	for (i=0; i<ntop; i++) {
+		if (top[i].ks_callsite == 0) {
+			kprintf("  (others)  ");
+		}
+		else {
+			kprintf("  0x%08lx  ", (unsigned long) top[i].ks_callsite);
+		}
+		kprintf("%8lu bytes  %6u live  %8u allocs\n",
+			(unsigned long) top[i].ks_livebytes,
+			top[i].ks_livecount, top[i].ks_allocs);
+	}
+	if (untracked > 0) {
+		kprintf("  (%u page allocations not tracked)\n", untracked);
+	}
+}
+
+#endif /* OPT_KMALLOCTRACE */
 
-		return (void *)address;
+void *
+kmalloc(size_t sz)
+{
+#if OPT_KMALLOCTRACE
+	return kmt_kmalloc(sz, (vaddr_t)__builtin_return_address(0));
+#else
+	if (sz>=LARGEST_SUBPAGE_SIZE) {
+		return bigpage_kmalloc(sz);
 	}
 
 	return subpage_kmalloc(sz);
+#endif
 }
 
 void
 kfree(void *ptr)
 {
+#if OPT_KMALLOCTRACE
+	if (ptr != NULL) {
+		kmt_kfree(ptr);
+	}
+#else
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
@@ -630,5 +910,5 @@ kfree(void *ptr)
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
+#endif
 }
-
@@ -45,6 +45,7 @@ copy(const char *from, const char *to)
 	int tofd;
 	char buf[1024];
 	int len, wr, wrtot;
+	int copied;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -59,6 +60,18 @@ copy(const char *from, const char *to)
 	}
 
 	/*
+	 * Have the kernel do the copying, without bringing the data
+	 * out to us, for as long as it can. Zero means EOF.
+	 */
+	while ((copied = copy_file_range(fromfd, tofd, 1024*1024)) > 0) {
+		/* nothing */
+	}
+	if (copied == 0) {
+		goto done;
+	}
+
+	/*
+	 * If that's not supported, fall back to doing it ourselves.
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
 	 * We may read less than we asked for, though, in various cases
@@ -85,6 +98,7 @@ copy(const char *from, const char *to)
 		err(1, "%s", from);
 	}
 
+ done:
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
 	}
@@ -292,12 +292,116 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * launch
+ * starts the command in args with its standard input and output on
+ * infd and outfd, and standard error on ours.  it gets no other file
+ * handles, so it can't hold a pipe open by accident.  uses spawn
+ * rather than fork and execv, so the kernel never copies our address
+ * space just to throw it away.  returns the child's pid, or -1.
+ */
+static
+pid_t
+launch(char **args, int infd, int outfd)
+{
+	int fds[3];
+	pid_t pid;
+
+	fds[0] = infd;
+	fds[1] = outfd;
+	fds[2] = STDERR_FILENO;
+	pid = spawn(args[0], args, fds, 3);
+	if (pid < 0) {
+		warn("%s", args[0]);
+	}
+	return pid;
+}
+
+/*
+ * dopipeline
+ * runs a command line containing "|" tokens, connecting each command's
+ * standard output to the next one's standard input with a pipe.  waits
+ * for all of them and returns the status of the last one.
+ */
+static
+int
+dopipeline(char **args, int nargs)
+{
+	pid_t pids[NARG_MAX/2 + 1];
+	int npids = 0;
+	char **cmd;
+	int infd, fds[2];
+	int i, status, result;
+	pid_t pid;
+
+	result = 0;
+	infd = STDIN_FILENO;
+	cmd = args;
+	for (i = 0; i <= nargs; i++) {
+		if (i < nargs && strcmp(args[i], "|")) {
+			continue;
+		}
+		args[i] = NULL;
+		if (cmd[0] == NULL) {
+			warnx("Missing command in pipeline");
+			result = _MKWAIT_EXIT(255);
+			break;
+		}
+
+		if (i < nargs) {
+			if (pipe(fds) < 0) {
+				warn("pipe");
+				result = _MKWAIT_EXIT(255);
+				break;
+			}
+		}
+		else {
+			/* last command: output goes where ours does */
+			fds[0] = -1;
+			fds[1] = STDOUT_FILENO;
+		}
+
+		pid = launch(cmd, infd, fds[1]);
+
+		/* the children have these now */
+		if (infd != STDIN_FILENO) {
+			close(infd);
+		}
+		if (fds[1] != STDOUT_FILENO) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+
+		if (pid < 0) {
+			result = _MKWAIT_EXIT(255);
+			break;
+		}
+		pids[npids++] = pid;
+		cmd = &args[i+1];
+	}
+	if (infd >= 0 && infd != STDIN_FILENO) {
+		close(infd);
+	}
+
+	for (i = 0; i < npids; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			status = -1;
+		}
+		if (i == npids-1 && result == 0) {
+			result = status;
+		}
+	}
+	return result;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * the job if possible, otherwise just run it and wait on it.  a command
+ * line with "|" in it is a pipeline, which can't be backgrounded.
  */
 static
 int
@@ -308,7 +412,7 @@ docommand(char *buf)
 	char *s;
 	pid_t pid;
 	int status;
-	int bg=0;
+	int bg=0, pipeline;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
 
@@ -350,43 +454,42 @@ docommand(char *buf)
 		bg = 1;
 	}
 
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			break;
+		}
+	}
+	pipeline = i < nargs;
+	if (pipeline && bg) {
+		printf("%s: Pipelines can't be run in the background\n",
+		       args[0]);
+		return -1;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
+	if (pipeline) {
+		status = dopipeline(args, nargs);
 	}
+	else {
+		pid = launch(args, STDIN_FILENO, STDOUT_FILENO);
+		if (pid < 0) {
+			return _MKWAIT_EXIT(255);
+		}
 
-	/* parent */
-	if (bg) {
-		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
-		return 0;
-	}
+		if (bg) {
+			/* background this command */
+			remember_bg(pid);
+			printf("[%d] %s ... &\n", pid, args[0]);
+			return 0;
+		}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		status = -1;
+		if (waitpid(pid, &status, 0) < 0) {
+			warn("waitpid");
+			status = -1;
+		}
 	}
 
 	if (timing) {
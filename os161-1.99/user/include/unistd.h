@@ -38,9 +38,11 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/iovec.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/syscallstats.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -118,6 +120,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t spawn(const char *prog, char *const *args, const int *fds, int nfds);
 int waitpid(pid_t pid, int *returncode, int flags);
 /* 
  * Open actually takes either two or three args: the optional third
@@ -151,9 +154,22 @@ int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+int fcntl(int filehandle, int cmd, ...);	/* F_GETFD and F_SETFD only */
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+int copy_file_range(int infile, int outfile, size_t len);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
+int futex_wait(volatile int *addr, int expected);
+int futex_wake(volatile int *addr, int count);
 int __getcwd(char *buf, size_t buflen);
+int __thread_create(void (*entry)(void (*)(void *), void *),
+		    void (*func)(void *), void *arg);
+__DEAD void thread_exit(void);
+int syscallstats(pid_t pid, int callno, struct syscallstat *buf);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -163,5 +179,6 @@ int __getcwd(char *buf, size_t buflen);
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int thread_create(void (*func)(void *), void *arg); /* calls __thread_create */
 
 #endif /* _UNISTD_H_ */
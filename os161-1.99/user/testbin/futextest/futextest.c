@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * futextest - a mutex built on futex_wait/futex_wake, hammered by
+ * several threads at once.
+ *
+ * NTHREADS threads each take the lock and bump a shared counter
+ * NINCS times, doing the increment as a separate load and store so
+ * that any hole in the mutual exclusion shows up as a lost update.
+ * The main thread sleeps on a futex until they've all finished and
+ * then checks the total.
+ *
+ * The mutex is the usual three-state one: 0 is unlocked, 1 is locked
+ * with nobody waiting, and 2 is locked with (possibly) somebody
+ * asleep in futex_wait, so unlock only has to call into the kernel
+ * when it sees 2.
+ *
+ * errno is a single global shared by every thread, so once the
+ * threads are running we go by return values alone: a failed
+ * futex_wait just means the word changed before we got to sleep.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NTHREADS	4
+#define NINCS		5000
+
+static volatile int lockword;
+static volatile int counter;
+static volatile int done;
+static volatile int nsleeps;
+
+/*
+ * Compare-and-swap using LL/SC: if *P is OLD, store NEW. Returns the
+ * value that was in *P either way.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   give up if x != old */
+		"move %1, %4;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   retry on failure */
+		"2: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return x;
+}
+
+/*
+ * Atomically store NEW in *P and return what was there.
+ */
+static
+int
+xchg(volatile int *p, int new)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (cas(p, old, new) != old);
+	return old;
+}
+
+static
+void
+atomic_inc(volatile int *p)
+{
+	int old;
+
+	do {
+		old = *p;
+	} while (cas(p, old, old + 1) != old);
+}
+
+static
+void
+mutex_lock(volatile int *m)
+{
+	int c;
+
+	c = cas(m, 0, 1);
+	if (c == 0) {
+		return;
+	}
+	if (c != 2) {
+		c = xchg(m, 2);
+	}
+	while (c != 0) {
+		if (futex_wait(m, 2) == 0) {
+			atomic_inc(&nsleeps);
+		}
+		c = xchg(m, 2);
+	}
+}
+
+static
+void
+mutex_unlock(volatile int *m)
+{
+	if (xchg(m, 0) == 2) {
+		if (futex_wake(m, 1) < 0) {
+			errx(1, "futex_wake failed");
+		}
+	}
+}
+
+static
+void
+incthread(void *arg)
+{
+	int i, tmp;
+
+	(void)arg;
+
+	for (i=0; i<NINCS; i++) {
+		mutex_lock(&lockword);
+		tmp = counter;
+		counter = tmp + 1;
+		mutex_unlock(&lockword);
+	}
+
+	mutex_lock(&lockword);
+	done++;
+	mutex_unlock(&lockword);
+	futex_wake(&done, 1);
+}
+
+/*
+ * The easy cases: waiting on a value that isn't there, and waking
+ * when nobody is asleep.
+ */
+static
+void
+basictest(void)
+{
+	volatile int word = 5;
+	int r;
+
+	r = futex_wait(&word, 6);
+	if (r >= 0 || errno != EAGAIN) {
+		errx(1, "futex_wait on a stale value returned %d (errno %d)",
+		     r, errno);
+	}
+	r = futex_wake(&word, 1);
+	if (r != 0) {
+		errx(1, "futex_wake with no waiters returned %d", r);
+	}
+}
+
+int
+main(void)
+{
+	int i, d;
+
+	printf("futextest: basic cases...\n");
+	basictest();
+
+	printf("futextest: %d threads, %d increments each...\n",
+	       NTHREADS, NINCS);
+	for (i=0; i<NTHREADS; i++) {
+		if (thread_create(incthread, NULL) < 0) {
+			errx(1, "thread_create failed");
+		}
+	}
+
+	while ((d = done) < NTHREADS) {
+		futex_wait(&done, d);
+	}
+
+	if (counter != NTHREADS * NINCS) {
+		errx(1, "counter is %d, expected %d", counter,
+		     NTHREADS * NINCS);
+	}
+	printf("futextest: passed (%d sleeps in futex_wait)\n", nsleeps);
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * pipetest - test pipe().
+ *
+ * Checks that data comes through intact when transfers wrap around
+ * the pipe's ring buffer at odd sizes, that a writer blocks while the
+ * pipe is full and carries on once it's drained, that the reader
+ * sees EOF once the write end is closed, and that writing with no
+ * reader fails with EPIPE.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+/* The kernel's pipe buffer size (PIPE_SIZE in kern/include/pipe.h) */
+#define PIPEBUF 2048
+
+/* Enough to go round the ring several times, and not a multiple. */
+#define WRAPBYTES (PIPEBUF * 7 + 123)
+
+static char buf[PIPEBUF * 3];
+
+static
+char
+pattern(unsigned pos)
+{
+	/* 251 is prime, so this doesn't line up with the ring either */
+	return 'a' + pos % 251 % 26;
+}
+
+static
+pid_t
+dofork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	return pid;
+}
+
+static
+void
+dowait(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: child failed", what);
+	}
+}
+
+/*
+ * Pause for a tenth of a second, to give the other side time to get
+ * stuck if it's going to.
+ */
+static
+void
+snooze(void)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Child writes WRAPBYTES in chunks of 333 bytes, while we read them
+ * in chunks of 517, checking every byte. Then we should get EOF.
+ */
+static
+void
+wraptest(void)
+{
+	int fds[2];
+	unsigned pos, i;
+	int len, n;
+	pid_t pid;
+
+	printf("pipetest: wraparound...\n");
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		for (pos = 0; pos < WRAPBYTES; pos += len) {
+			len = WRAPBYTES - pos < 333 ? WRAPBYTES - pos : 333;
+			for (i = 0; i < (unsigned)len; i++) {
+				buf[i] = pattern(pos + i);
+			}
+			n = write(fds[1], buf, len);
+			if (n != len) {
+				warn("write at %u returned %d", pos, n);
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	pos = 0;
+	while ((n = read(fds[0], buf, 517)) > 0) {
+		for (i = 0; i < (unsigned)n; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				errx(1, "byte %u is %d, should be %d",
+				     pos + i, buf[i], pattern(pos + i));
+			}
+		}
+		pos += n;
+	}
+	if (n < 0) {
+		err(1, "read");
+	}
+	if (pos != WRAPBYTES) {
+		errx(1, "got %u bytes before EOF, expected %u",
+		     pos, WRAPBYTES);
+	}
+	close(fds[0]);
+	dowait(pid, "wraparound");
+}
+
+/*
+ * Child writes three pipefuls in one write. That can't finish until
+ * we read, so after a pause it should still be running. Then we
+ * drain the pipe and it should finish, having written everything.
+ * Once it has exited (closing the write end), we see EOF.
+ */
+static
+void
+blocktest(void)
+{
+	int fds[2];
+	int n, total, status;
+	pid_t pid;
+
+	printf("pipetest: full pipe blocks the writer...\n");
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		memset(buf, 'x', sizeof(buf));
+		n = write(fds[1], buf, sizeof(buf));
+		_exit(n == (int)sizeof(buf) ? 0 : 1);
+	}
+	close(fds[1]);
+
+	snooze();
+	if (waitpid(pid, &status, WNOHANG) != 0) {
+		errx(1, "writer finished with nobody reading");
+	}
+
+	total = 0;
+	while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+		total += n;
+	}
+	if (n < 0) {
+		err(1, "read");
+	}
+	if (total != (int)sizeof(buf)) {
+		errx(1, "read %d bytes, expected %d", total,
+		     (int)sizeof(buf));
+	}
+	close(fds[0]);
+	dowait(pid, "blocking write");
+}
+
+/*
+ * Writing with the read end closed fails with EPIPE. If the reader
+ * goes away while we're blocked, the write comes back short (it got
+ * one pipeful in) and the next one fails.
+ */
+static
+void
+epipetest(void)
+{
+	int fds[2];
+	int n;
+	pid_t pid;
+
+	printf("pipetest: EPIPE...\n");
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	n = write(fds[1], "x", 1);
+	if (n >= 0 || errno != EPIPE) {
+		errx(1, "write with no reader returned %d (errno %d)",
+		     n, errno);
+	}
+	close(fds[1]);
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		while ((n = write(fds[1], buf, sizeof(buf))) > 0) {
+			/* nothing */
+		}
+		_exit(n < 0 && errno == EPIPE ? 0 : 1);
+	}
+	close(fds[1]);
+	/* let the child fill the pipe and block, then walk away */
+	snooze();
+	close(fds[0]);
+	dowait(pid, "EPIPE while blocked");
+}
+
+int
+main(void)
+{
+	wraptest();
+	blocktest();
+	epipetest();
+	printf("pipetest: passed\n");
+	return 0;
+}
@@ -429,6 +429,24 @@ dowait(int guy, pid_t pid)
 	return 0;
 }
 
+static
+void
+dowaitall(const char *phasename, pid_t *pids, int bad)
+{
+	int i;
+
+	for (i=0; i<numprocs; i++) {
+		if (pids[i] > 0 && dowait(i, pids[i])) {
+			bad = 1;
+		}
+	}
+
+	if (bad) {
+		complainx("%s failed.", phasename);
+		exit(1);
+	}
+}
+
 static
 void
 doforkall(const char *phasename, void (*func)(void))
@@ -449,16 +467,29 @@ doforkall(const char *phasename, void (*func)(void))
 		}
 	}
 
+	dowaitall(phasename, pids, bad);
+}
+
+/*
+ * Like doforkall, but FUNC runs in the parent and starts a program
+ * with spawn, returning its pid (or -1).
+ */
+static
+void
+dospawnall(const char *phasename, pid_t (*func)(void))
+{
+	int i, bad = 0;
+	pid_t pids[numprocs];
+
 	for (i=0; i<numprocs; i++) {
-		if (pids[i] > 0 && dowait(i, pids[i])) {
+		me = i;
+		pids[i] = func();
+		if (pids[i] < 0) {
 			bad = 1;
 		}
 	}
 
-	if (bad) {
-		complainx("%s failed.", phasename);
-		exit(1);
-	}
+	dowaitall(phasename, pids, bad);
 }
 
 static
@@ -777,12 +808,14 @@ mergebins(void)
 }
 
 static
-void
+pid_t
 assemble(void)
 {
 	off_t mypos;
 	int i, fd;
 	const char *args[3];
+	int fds[3];
+	pid_t pid;
 
 	mypos = 0;
 	for (i=0; i<me; i++) {
@@ -792,19 +825,21 @@ assemble(void)
 	fd = doopen(PATH_SORTED, O_WRONLY, 0);
 	dolseek(PATH_SORTED, fd, mypos, SEEK_SET);
 
-	if (dup2(fd, STDOUT_FILENO) < 0) {
-		complain("dup2");
-		exit(1);
-	}
-
-	doclose(PATH_SORTED, fd);
+	/* cat's standard output is FD */
+	fds[0] = STDIN_FILENO;
+	fds[1] = fd;
+	fds[2] = STDERR_FILENO;
 
 	args[0] = "cat";
 	args[1] = mergedname(me);
 	args[2] = NULL;
-	execv("/bin/cat", (char **) args);
-	complain("/bin/cat: exec");
-	exit(1);
+	pid = spawn("/bin/cat", (char **) args, fds, 3);
+	if (pid < 0) {
+		complain("/bin/cat: spawn");
+	}
+
+	doclose(PATH_SORTED, fd);
+	return pid;
 }
 
 static
@@ -876,7 +911,7 @@ sort(void)
 
 	/* Step 4: assemble output file */
 	docreate(PATH_SORTED);
-	doforkall("Final assembly", assemble);
+	dospawnall("Final assembly", assemble);
 	if (getsize(PATH_SORTED) != correctsize) {
 		complainx("%s: file is wrong size", PATH_SORTED);
 		exit(1);
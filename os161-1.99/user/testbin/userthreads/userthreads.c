@@ -32,17 +32,11 @@
  * forks 3 threads off 2 to functions, each of which displays a string
  * every once in a while.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
+ * Threads are created with thread_create(), which runs the given
+ * function in the new thread and calls thread_exit() when it
+ * returns. The parent leaves with thread_exit() rather than by
+ * returning from main, since that would call exit() and take the
+ * other threads with it.
  *
  * This is also a rather basic test and you'll probably want to write
  * some more of your own.
@@ -61,8 +55,8 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+void ThreadRunner(void *);
+void BladeRunner(void *);
 
 int
 main(int argc, char *argv[])
@@ -74,13 +68,13 @@ main(int argc, char *argv[])
 
     for (i=0; i<NTHREADS; i++) {
 	if (i)
-	    threadfork(ThreadRunner);
+	    thread_create(ThreadRunner, NULL);
         else
-	    threadfork(BladeRunner);
+	    thread_create(BladeRunner, NULL);
     }
 
     printf("Parent has left.\n");
-    return 0;
+    thread_exit();
 }
 
 /* multiple threads will simply print out the global variable.
@@ -89,8 +83,10 @@ main(int argc, char *argv[])
 */
 
 void
-BladeRunner()
+BladeRunner(void *unused)
 {
+    (void)unused;
+
     while (count < MAX) {
 	if (count % 500 == 0)
 	    printf("Blade ");
@@ -99,8 +95,10 @@ BladeRunner()
 }
 
 void
-ThreadRunner()
+ThreadRunner(void *unused)
 {
+    (void)unused;
+
     while (count < MAX) {
 	if (count % 513 == 0)
 	    printf(" Runner\n");